@@ -38,14 +38,59 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <fstream>
 #include <algorithm>
 #include <cstdlib>
+#include <cstdio>
+#include <cstring>
 #include <ctime>
 #include <memory>
 #include <set>
+#include <map>
+#include <unordered_map>
 #include <cmath>
 #include <stdexcept>
+#include <functional>
+#include <thread>
+#include <atomic>
+#include <future>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <cstdint>
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <typeinfo>
+#include <iterator>
 
 #include <iostream>
 
+#if __cplusplus >= 201703L && defined(__has_include)
+#if __has_include(<charconv>)
+#include <charconv>
+#if defined(__cpp_lib_to_chars) && __cpp_lib_to_chars >= 201611L
+#define SVG_WRITER_TO_CHARS
+#endif
+#endif
+#endif
+
+#if !defined(SVG_WRITER_NO_SIMD) && (defined(__GNUC__) || defined(__clang__)) && \
+    (defined(__x86_64__) || (defined(__i386__) && defined(__SSE2__)))
+#define SVG_WRITER_X86_SIMD
+#include <immintrin.h>
+#endif
+
+#if defined(__unix__) || defined(__APPLE__)
+#define SVG_WRITER_POSIX_IO
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+// Define SVG_WRITER_HAVE_ZLIB (done by CMake if zlib is found) and link zlib for .svgz output.
+#ifdef SVG_WRITER_HAVE_ZLIB
+#include <zlib.h>
+#endif
+
 namespace svg {
 
 // Version information.
@@ -53,6 +98,800 @@ inline std::string libraryName()    { return "svg-writer"; }
 inline std::string libraryVersion() { return "1.0.0"; }
 inline std::string svgVersion()     { return "1.1"; }
 
+namespace internal {
+
+// Locale-independent shortest round-trip formatting of doubles (Grisu2, following Florian Loitsch,
+// "Printing Floating-Point Numbers Quickly and Accurately with Integers", PLDI 2010). If available
+// (C++17), std::to_chars() is used for the digit generation instead which is always shortest.
+class DiyFp {
+public:
+    DiyFp(uint64_t fp = 0, int exp = 0) : f(fp), e(exp) { }
+    explicit DiyFp(double d)
+    {
+        uint64_t u;
+        std::memcpy(&u, &d, sizeof(d));
+        const int biased_e = static_cast<int>((u & EXPONENT_MASK) >> SIGNIFICAND_SIZE);
+        const uint64_t significand = u & SIGNIFICAND_MASK;
+        if (biased_e != 0) {
+            f = significand + HIDDEN_BIT;
+            e = biased_e - EXPONENT_BIAS;
+        } else {
+            f = significand;
+            e = 1 - EXPONENT_BIAS;
+        }
+    }
+    DiyFp operator-(DiyFp const & rhs) const { return DiyFp(f - rhs.f, e); }
+    DiyFp operator*(DiyFp const & rhs) const
+    {
+        const uint64_t M32 = 0xFFFFFFFFu;
+        const uint64_t a = f >> 32, b = f & M32, c = rhs.f >> 32, d = rhs.f & M32;
+        const uint64_t ac = a * c, bc = b * c, ad = a * d, bd = b * d;
+        uint64_t tmp = (bd >> 32) + (ad & M32) + (bc & M32);
+        tmp += 1U << 31; // round
+        return DiyFp(ac + (ad >> 32) + (bc >> 32) + (tmp >> 32), e + rhs.e + 64);
+    }
+    DiyFp normalize() const
+    {
+        DiyFp res = *this;
+        while (!(res.f & (uint64_t(1) << 63))) {
+            res.f <<= 1;
+            res.e--;
+        }
+        return res;
+    }
+    // Computes the normalized boundaries m- and m+ of this (non-normalized) value.
+    void normalizedBoundaries(DiyFp *minus, DiyFp *plus) const
+    {
+        DiyFp pl(((f << 1) + 1), e - 1);
+        while (!(pl.f & (HIDDEN_BIT << 1))) {
+            pl.f <<= 1;
+            pl.e--;
+        }
+        pl.f <<= 64 - SIGNIFICAND_SIZE - 2;
+        pl.e -= 64 - SIGNIFICAND_SIZE - 2;
+        DiyFp mi = (f == HIDDEN_BIT) ? DiyFp((f << 2) - 1, e - 2) : DiyFp((f << 1) - 1, e - 1);
+        mi.f <<= mi.e - pl.e;
+        mi.e = pl.e;
+        *plus = pl;
+        *minus = mi;
+    }
+
+    uint64_t f;
+    int e;
+
+private:
+    static const int SIGNIFICAND_SIZE = 52;
+    static const int EXPONENT_BIAS = 0x3FF + SIGNIFICAND_SIZE;
+    static const uint64_t EXPONENT_MASK = 0x7FF0000000000000ULL;
+    static const uint64_t SIGNIFICAND_MASK = 0x000FFFFFFFFFFFFFULL;
+    static const uint64_t HIDDEN_BIT = 0x0010000000000000ULL;
+};
+
+// Cached powers 10^k (k = -348, -340, ..., 340) as normalized DiyFp.
+inline DiyFp cachedPower(int e, int *k)
+{
+    static const uint64_t F[] = {
+        0xfa8fd5a0081c0288ULL, 0xbaaee17fa23ebf76ULL, 0x8b16fb203055ac76ULL,
+        0xcf42894a5dce35eaULL, 0x9a6bb0aa55653b2dULL, 0xe61acf033d1a45dfULL,
+        0xab70fe17c79ac6caULL, 0xff77b1fcbebcdc4fULL, 0xbe5691ef416bd60cULL,
+        0x8dd01fad907ffc3cULL, 0xd3515c2831559a83ULL, 0x9d71ac8fada6c9b5ULL,
+        0xea9c227723ee8bcbULL, 0xaecc49914078536dULL, 0x823c12795db6ce57ULL,
+        0xc21094364dfb5637ULL, 0x9096ea6f3848984fULL, 0xd77485cb25823ac7ULL,
+        0xa086cfcd97bf97f4ULL, 0xef340a98172aace5ULL, 0xb23867fb2a35b28eULL,
+        0x84c8d4dfd2c63f3bULL, 0xc5dd44271ad3cdbaULL, 0x936b9fcebb25c996ULL,
+        0xdbac6c247d62a584ULL, 0xa3ab66580d5fdaf6ULL, 0xf3e2f893dec3f126ULL,
+        0xb5b5ada8aaff80b8ULL, 0x87625f056c7c4a8bULL, 0xc9bcff6034c13053ULL,
+        0x964e858c91ba2655ULL, 0xdff9772470297ebdULL, 0xa6dfbd9fb8e5b88fULL,
+        0xf8a95fcf88747d94ULL, 0xb94470938fa89bcfULL, 0x8a08f0f8bf0f156bULL,
+        0xcdb02555653131b6ULL, 0x993fe2c6d07b7facULL, 0xe45c10c42a2b3b06ULL,
+        0xaa242499697392d3ULL, 0xfd87b5f28300ca0eULL, 0xbce5086492111aebULL,
+        0x8cbccc096f5088ccULL, 0xd1b71758e219652cULL, 0x9c40000000000000ULL,
+        0xe8d4a51000000000ULL, 0xad78ebc5ac620000ULL, 0x813f3978f8940984ULL,
+        0xc097ce7bc90715b3ULL, 0x8f7e32ce7bea5c70ULL, 0xd5d238a4abe98068ULL,
+        0x9f4f2726179a2245ULL, 0xed63a231d4c4fb27ULL, 0xb0de65388cc8ada8ULL,
+        0x83c7088e1aab65dbULL, 0xc45d1df942711d9aULL, 0x924d692ca61be758ULL,
+        0xda01ee641a708deaULL, 0xa26da3999aef774aULL, 0xf209787bb47d6b85ULL,
+        0xb454e4a179dd1877ULL, 0x865b86925b9bc5c2ULL, 0xc83553c5c8965d3dULL,
+        0x952ab45cfa97a0b3ULL, 0xde469fbd99a05fe3ULL, 0xa59bc234db398c25ULL,
+        0xf6c69a72a3989f5cULL, 0xb7dcbf5354e9beceULL, 0x88fcf317f22241e2ULL,
+        0xcc20ce9bd35c78a5ULL, 0x98165af37b2153dfULL, 0xe2a0b5dc971f303aULL,
+        0xa8d9d1535ce3b396ULL, 0xfb9b7cd9a4a7443cULL, 0xbb764c4ca7a44410ULL,
+        0x8bab8eefb6409c1aULL, 0xd01fef10a657842cULL, 0x9b10a4e5e9913129ULL,
+        0xe7109bfba19c0c9dULL, 0xac2820d9623bf429ULL, 0x80444b5e7aa7cf85ULL,
+        0xbf21e44003acdd2dULL, 0x8e679c2f5e44ff8fULL, 0xd433179d9c8cb841ULL,
+        0x9e19db92b4e31ba9ULL, 0xeb96bf6ebadf77d9ULL, 0xaf87023b9bf0ee6bULL,
+    };
+    static const int16_t E[] = {
+        -1220, -1193, -1166, -1140, -1113, -1087, -1060, -1034, -1007, -980, -954, -927,
+        -901, -874, -847, -821, -794, -768, -741, -715, -688, -661, -635, -608,
+        -582, -555, -529, -502, -475, -449, -422, -396, -369, -343, -316, -289,
+        -263, -236, -210, -183, -157, -130, -103, -77, -50, -24, 3, 30,
+        56, 83, 109, 136, 162, 189, 216, 242, 269, 295, 322, 348,
+        375, 402, 428, 455, 481, 508, 534, 561, 588, 614, 641, 667,
+        694, 720, 747, 774, 800, 827, 853, 880, 907, 933, 960, 986,
+        1013, 1039, 1066,
+    };
+    const double dk = (-61 - e) * 0.30102999566398114 + 347; // dk must be positive, so can do ceiling in positive
+    int ik = static_cast<int>(dk);
+    if (dk - ik > 0.0) {
+        ik++;
+    }
+    const unsigned index = static_cast<unsigned>((ik >> 3) + 1);
+    *k = -(-348 + static_cast<int>(index << 3)); // decimal exponent no need lookup table
+    return DiyFp(F[index], E[index]);
+}
+
+static const uint64_t POW10[] = {
+    1ULL, 10ULL, 100ULL, 1000ULL, 10000ULL, 100000ULL, 1000000ULL, 10000000ULL, 100000000ULL,
+    1000000000ULL, 10000000000ULL, 100000000000ULL, 1000000000000ULL, 10000000000000ULL,
+    100000000000000ULL, 1000000000000000ULL, 10000000000000000ULL, 100000000000000000ULL,
+    1000000000000000000ULL, 10000000000000000000ULL
+};
+
+inline void grisuRound(char *buffer, int len, uint64_t delta, uint64_t rest, uint64_t ten_kappa, uint64_t wp_w)
+{
+    while (rest < wp_w && delta - rest >= ten_kappa &&
+           (rest + ten_kappa < wp_w || wp_w - rest > rest + ten_kappa - wp_w)) {
+        buffer[len - 1]--;
+        rest += ten_kappa;
+    }
+}
+
+inline int countDecimalDigits(uint32_t n)
+{
+    int digits = 1;
+    while (digits < 10 && n >= POW10[digits]) {
+        digits++;
+    }
+    return digits;
+}
+
+inline void digitGen(DiyFp const & W, DiyFp const & Mp, uint64_t delta, char *buffer, int *len, int *k)
+{
+    const DiyFp one(uint64_t(1) << -Mp.e, Mp.e);
+    const DiyFp wp_w = Mp - W;
+    uint32_t p1 = static_cast<uint32_t>(Mp.f >> -one.e);
+    uint64_t p2 = Mp.f & (one.f - 1);
+    int kappa = countDecimalDigits(p1);
+    *len = 0;
+
+    while (kappa > 0) {
+        const uint32_t d = static_cast<uint32_t>(p1 / POW10[kappa - 1]);
+        p1 = static_cast<uint32_t>(p1 % POW10[kappa - 1]);
+        if (d || *len) {
+            buffer[(*len)++] = static_cast<char>('0' + d);
+        }
+        kappa--;
+        const uint64_t tmp = (static_cast<uint64_t>(p1) << -one.e) + p2;
+        if (tmp <= delta) {
+            *k += kappa;
+            grisuRound(buffer, *len, delta, tmp, POW10[kappa] << -one.e, wp_w.f);
+            return;
+        }
+    }
+
+    for (;;) {
+        p2 *= 10;
+        delta *= 10;
+        const char d = static_cast<char>(p2 >> -one.e);
+        if (d || *len) {
+            buffer[(*len)++] = static_cast<char>('0' + d);
+        }
+        p2 &= one.f - 1;
+        kappa--;
+        if (p2 < delta) {
+            *k += kappa;
+            const int index = -kappa;
+            grisuRound(buffer, *len, delta, p2, one.f, wp_w.f * (index < 20 ? POW10[index] : 0));
+            return;
+        }
+    }
+}
+
+// Generates the shortest digit string of `value` (> 0, finite) such that value = digits * 10^k.
+inline int shortestDigits(double value, char *digits, int *k)
+{
+#ifdef SVG_WRITER_TO_CHARS
+    char tmp[32];
+    const std::to_chars_result res = std::to_chars(tmp, tmp + sizeof(tmp), value, std::chars_format::scientific);
+    int len = 0;
+    const char *p = tmp;
+    for (; p != res.ptr && *p != 'e'; ++p) {
+        if (*p != '.') {
+            digits[len++] = *p;
+        }
+    }
+    int exp = 0;
+    const bool negative = p + 1 < res.ptr && p[1] == '-';
+    for (p += 2; p < res.ptr; ++p) {
+        exp = exp * 10 + (*p - '0');
+    }
+    *k = (negative ? -exp : exp) - (len - 1);
+    return len;
+#else
+    const DiyFp v(value);
+    DiyFp w_m, w_p;
+    v.normalizedBoundaries(&w_m, &w_p);
+
+    const DiyFp c_mk = cachedPower(w_p.e, k);
+    const DiyFp W = v.normalize() * c_mk;
+    DiyFp Wp = w_p * c_mk;
+    DiyFp Wm = w_m * c_mk;
+    Wm.f++;
+    Wp.f--;
+    int len;
+    digitGen(W, Wp, Wp.f - Wm.f, digits, &len, k);
+    return len;
+#endif
+}
+
+/**
+ * Writes the shortest representation of `value` which parses back to the identical double into
+ * `buffer` (at least 32 chars) and returns the number of chars written. Like JavaScript's
+ * Number.toString(), the exponential notation is used outside of [1e-7, 1e21) only.
+ */
+inline size_t formatDouble(double value, char *buffer)
+{
+    char *p = buffer;
+    if (std::isnan(value)) {
+        std::memcpy(p, "nan", 3);
+        return 3;
+    }
+    if (std::signbit(value)) {
+        value = -value;
+        if (value != 0) {
+            *p++ = '-';
+        }
+    }
+    if (std::isinf(value)) {
+        std::memcpy(p, "inf", 3);
+        return size_t(p - buffer) + 3;
+    }
+    if (value == 0) {
+        *p = '0';
+        return 1;
+    }
+
+    char digits[24];
+    int k;
+    const int len = shortestDigits(value, digits, &k);
+    const int point = len + k; // position of the decimal point relative to the digits
+
+    if (len <= point && point <= 21) {
+        // Integer, e.g., 1234e7 -> 12340000000
+        std::memcpy(p, digits, size_t(len));
+        std::memset(p + len, '0', size_t(point - len));
+        p += point;
+    } else if (0 < point && point <= 21) {
+        // Decimal point within the digits, e.g., 1234e-2 -> 12.34
+        std::memcpy(p, digits, size_t(point));
+        p[point] = '.';
+        std::memcpy(p + point + 1, digits + point, size_t(len - point));
+        p += len + 1;
+    } else if (-6 < point && point <= 0) {
+        // Leading zeros, e.g., 1234e-6 -> 0.001234
+        *p++ = '0';
+        *p++ = '.';
+        std::memset(p, '0', size_t(-point));
+        p += -point;
+        std::memcpy(p, digits, size_t(len));
+        p += len;
+    } else {
+        // Exponential notation, e.g., 1234e30 -> 1.234e+33
+        *p++ = digits[0];
+        if (len > 1) {
+            *p++ = '.';
+            std::memcpy(p, digits + 1, size_t(len - 1));
+            p += len - 1;
+        }
+        int exp = point - 1;
+        *p++ = 'e';
+        *p++ = exp < 0 ? '-' : '+';
+        exp = exp < 0 ? -exp : exp;
+        if (exp >= 100) {
+            *p++ = static_cast<char>('0' + exp / 100);
+            exp %= 100;
+            *p++ = static_cast<char>('0' + exp / 10);
+        } else if (exp >= 10) {
+            *p++ = static_cast<char>('0' + exp / 10);
+        }
+        *p++ = static_cast<char>('0' + exp % 10);
+    }
+    return size_t(p - buffer);
+}
+
+// Writes `value` into `buffer` (at least 24 chars) and returns the number of chars written.
+inline size_t formatInteger(long long value, char *buffer)
+{
+    char *p = buffer;
+    unsigned long long u = static_cast<unsigned long long>(value);
+    if (value < 0) {
+        *p++ = '-';
+        u = 0ULL - u;
+    }
+    char tmp[24];
+    char *end = tmp + sizeof(tmp);
+    char *q = end;
+    do {
+        *--q = static_cast<char>('0' + u % 10);
+        u /= 10;
+    } while (u != 0);
+    std::memcpy(p, q, size_t(end - q));
+    return size_t(p - buffer) + size_t(end - q);
+}
+
+// Rounds `value` to an integral multiple `units` of 10^-decimals, \c false if that is not exact.
+inline bool quantize(double value, int decimals, long long & units)
+{
+    const double scaled = value * static_cast<double>(POW10[decimals]);
+    if (!(std::fabs(scaled) < 9007199254740992.0)) { // 2^53, also catches NaNs and Infs
+        return false;
+    }
+    units = static_cast<long long>(scaled < 0 ? scaled - 0.5 : scaled + 0.5);
+    return true;
+}
+
+// Formats `rounded` * 10^-decimals, dropping trailing zeros of the fractional part.
+inline size_t formatScaled(long long rounded, int decimals, char *buffer)
+{
+    if (rounded == 0) {
+        *buffer = '0';
+        return 1;
+    }
+    char *p = buffer;
+    unsigned long long u = static_cast<unsigned long long>(rounded);
+    if (rounded < 0) {
+        *p++ = '-';
+        u = 0ULL - u;
+    }
+    // Drop trailing zeros of the fractional part:
+    while (decimals > 0 && u % 10 == 0) {
+        u /= 10;
+        decimals--;
+    }
+    char tmp[24];
+    char *end = tmp + sizeof(tmp);
+    char *q = end;
+    int n = 0;
+    do {
+        if (n == decimals && n > 0) {
+            *--q = '.';
+        }
+        *--q = static_cast<char>('0' + u % 10);
+        u /= 10;
+        n++;
+    } while (u != 0 || n <= decimals);
+    std::memcpy(p, q, size_t(end - q));
+    return size_t(p - buffer) + size_t(end - q);
+}
+
+/**
+ * Writes `value` rounded to `decimals` (<= 15) decimal places into `buffer` (at least 32 chars),
+ * omitting trailing zeros (and the decimal point if possible). Returns the number of chars written.
+ * Values too large for an exact integer representation fall back to formatDouble().
+ */
+inline size_t formatFixed(double value, int decimals, char *buffer)
+{
+    long long rounded;
+    return quantize(value, decimals, rounded) ? formatScaled(rounded, decimals, buffer) : formatDouble(value, buffer);
+}
+
+// Formats a coordinate with `decimals` decimal places (shortest round-trip if negative). Integral
+// values take a fast path without any floating point digit generation.
+inline size_t formatCoordinate(double value, int decimals, char *buffer)
+{
+    if (std::fabs(value) < 9007199254740992.0) {
+        const long long integral = static_cast<long long>(value);
+        if (static_cast<double>(integral) == value) {
+            return formatInteger(integral, buffer);
+        }
+    }
+    return decimals < 0 ? formatDouble(value, buffer) : formatFixed(value, decimals, buffer);
+}
+
+} // end of namespace: internal (within namespace "svg")
+
+namespace internal {
+    class StyleCache;
+}
+
+// Output sink that all serialization goes through. Bytes are appended to one contiguous, growing
+// buffer; sinks forwarding to an actual destination (see OStreamSink) drain it in flush() once it
+// has reached `capacity` bytes. A capacity of 0 never flushes automatically.
+class Sink {
+public:
+    // Default buffer size of sinks writing to files, streams, etc.
+    static const size_t DEFAULT_CAPACITY = 1 << 16;
+
+    explicit Sink(size_t buffer_capacity = 0)
+        : capacity(buffer_capacity), failed(false), compact(false), css(false), style_class(nullptr),
+          style_cache(nullptr)
+    {
+        buffer.reserve(buffer_capacity);
+    }
+    virtual ~Sink() { }
+    Sink & write(const char *data, size_t n)
+    {
+        buffer.append(data, n);
+        if (capacity != 0 && buffer.size() >= capacity) {
+            flush();
+        }
+        return *this;
+    }
+    Sink & operator<<(char c) { return write(&c, 1); }
+    Sink & operator<<(const char *str) { return write(str, std::strlen(str)); }
+    Sink & operator<<(std::string const & str) { return write(str.data(), str.size()); }
+    // Shortest round-trip representation, independent of the current locale.
+    Sink & operator<<(double value)
+    {
+        char tmp[32];
+        return write(tmp, internal::formatDouble(value, tmp));
+    }
+    // Writes `value` rounded to `decimals` decimal places (shortest round-trip if negative).
+    Sink & writeFixed(double value, int decimals)
+    {
+        char tmp[32];
+        return write(tmp, internal::formatCoordinate(value, decimals, tmp));
+    }
+    Sink & operator<<(unsigned long long value)
+    {
+        char tmp[24];
+        char *end = tmp + sizeof(tmp);
+        char *p = end;
+        do {
+            *--p = char('0' + value % 10);
+            value /= 10;
+        } while (value != 0);
+        return write(p, size_t(end - p));
+    }
+    Sink & operator<<(long long value)
+    {
+        char tmp[24];
+        return write(tmp, internal::formatInteger(value, tmp));
+    }
+    Sink & operator<<(unsigned long value) { return *this << static_cast<unsigned long long>(value); }
+    Sink & operator<<(long value) { return *this << static_cast<long long>(value); }
+    Sink & operator<<(unsigned value) { return *this << static_cast<unsigned long long>(value); }
+    Sink & operator<<(int value) { return *this << static_cast<long long>(value); }
+    // Forwards all buffered bytes to the destination (no-op for in-memory sinks).
+    virtual void flush() { }
+    // \c false if forwarding bytes to the destination has failed at least once.
+    bool good() const { return !failed; }
+    // Compact output omits all formatting whitespace and attributes equal to their SVG defaults.
+    bool isCompact() const { return compact; }
+    void setCompact(bool enable = true) { compact = enable; }
+    // In CSS mode, attributes are written as CSS declarations "name:value;" instead.
+    bool isCss() const { return css; }
+    void setCss(bool enable = true) { css = enable; }
+    // CSS class of the shape being written (if any), it replaces the shape's style attributes.
+    const char *styleClass() const { return style_class; }
+    void setStyleClass(const char *name) { style_class = name; }
+    // Serialized styles shared by all shapes written during one document write (if any).
+    internal::StyleCache *styleCache() const { return style_cache; }
+    void setStyleCache(internal::StyleCache *cache) { style_cache = cache; }
+protected:
+    std::string buffer;
+    size_t capacity;
+    bool failed;
+    bool compact;
+    bool css;
+    const char *style_class;
+    internal::StyleCache *style_cache;
+};
+
+// In-memory sink, the serialized bytes are available via str(). If constructed with a `target`
+// string, bytes are appended to it in chunks instead (and finally when the sink is destroyed).
+class StringSink : public Sink {
+public:
+    StringSink() : target(nullptr) { }
+    explicit StringSink(std::string & target_str, size_t buffer_capacity = DEFAULT_CAPACITY)
+        : Sink(buffer_capacity), target(&target_str) { }
+    virtual ~StringSink() { flush(); }
+    const std::string & str() const { return buffer; }
+    // Moves the buffered bytes out of the sink, leaving it empty.
+    std::string release()
+    {
+        std::string result;
+        result.swap(buffer);
+        return result;
+    }
+    void flush() override
+    {
+        if (target) {
+            target->append(buffer);
+            buffer.clear();
+        }
+    }
+private:
+    std::string *target;
+};
+
+// Sink forwarding to a std::ostream in chunks of `buffer_capacity` bytes.
+class OStreamSink : public Sink {
+public:
+    explicit OStreamSink(std::ostream & os, size_t buffer_capacity = DEFAULT_CAPACITY)
+        : Sink(buffer_capacity), stream(os) { }
+    virtual ~OStreamSink() { flush(); }
+    void flush() override
+    {
+        if (!buffer.empty()) {
+            stream.write(buffer.data(), std::streamsize(buffer.size()));
+            buffer.clear();
+            failed = failed || !stream.good();
+        }
+    }
+private:
+    std::ostream & stream;
+};
+
+// Sink forwarding to a C stream (FILE*). The stream is closed on destruction only if it has been
+// opened by the sink itself (that is, when constructed with a file name).
+class FileSink : public Sink {
+public:
+    explicit FileSink(std::FILE *file, size_t buffer_capacity = DEFAULT_CAPACITY)
+        : Sink(buffer_capacity), fp(file), owned(false) { failed = !fp; }
+    explicit FileSink(const std::string &filename, size_t buffer_capacity = DEFAULT_CAPACITY)
+        : Sink(buffer_capacity), fp(std::fopen(filename.c_str(), "wb")), owned(true) { failed = !fp; }
+    virtual ~FileSink() { close(); }
+    bool isOpen() const { return fp != nullptr; }
+    void flush() override
+    {
+        if (!buffer.empty()) {
+            if (!fp || std::fwrite(buffer.data(), 1, buffer.size(), fp) != buffer.size()) {
+                failed = true;
+            }
+            buffer.clear();
+        }
+    }
+    // Flushes all pending bytes and closes the stream if owned, returns \c true on success.
+    bool close()
+    {
+        flush();
+        if (fp && owned) {
+            failed = std::fclose(fp) != 0 || failed;
+        } else if (fp) {
+            failed = std::fflush(fp) != 0 || failed;
+        }
+        fp = nullptr;
+        return good();
+    }
+private:
+    std::FILE *fp;
+    bool owned;
+};
+
+// Sink handing every chunk of `buffer_capacity` bytes to a user-provided function.
+class CallbackSink : public Sink {
+public:
+    typedef std::function<void(const char *data, size_t size)> Callback;
+
+    explicit CallbackSink(Callback cb, size_t buffer_capacity = DEFAULT_CAPACITY)
+        : Sink(buffer_capacity), callback(cb) { }
+    virtual ~CallbackSink() { flush(); }
+    void flush() override
+    {
+        if (!buffer.empty()) {
+            callback(buffer.data(), buffer.size());
+            buffer.clear();
+        }
+    }
+private:
+    Callback callback;
+};
+
+#ifdef SVG_WRITER_POSIX_IO
+// Sink writing its buffer directly to a file descriptor via write(2), bypassing any stdio or
+// iostream layer. The descriptor is closed on destruction only if it has been opened by the sink.
+class FdSink : public Sink {
+public:
+    explicit FdSink(int file_descriptor, size_t buffer_capacity = DEFAULT_CAPACITY)
+        : Sink(buffer_capacity), fd(file_descriptor), owned(false) { failed = fd < 0; }
+    // New files are created with 0666 minus the umask, like std::ofstream does.
+    explicit FdSink(const std::string &filename, size_t buffer_capacity = DEFAULT_CAPACITY)
+        : Sink(buffer_capacity), fd(::open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666)),
+          owned(true) { failed = fd < 0; }
+    virtual ~FdSink() { close(); }
+    bool isOpen() const { return fd >= 0; }
+    void flush() override
+    {
+        const char *data = buffer.data();
+        size_t remaining = buffer.size();
+        while (remaining > 0 && fd >= 0) {
+            ssize_t n = ::write(fd, data, remaining);
+            if (n < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                break;
+            }
+            data += n;
+            remaining -= size_t(n);
+        }
+        failed = failed || remaining > 0;
+        buffer.clear();
+    }
+    // Flushes all pending bytes and closes the descriptor if owned, returns \c true on success.
+    bool close()
+    {
+        flush();
+        if (fd >= 0 && owned) {
+            failed = ::close(fd) != 0 || failed;
+        }
+        fd = -1;
+        return good();
+    }
+private:
+    int fd;
+    bool owned;
+};
+#endif
+
+#ifdef SVG_WRITER_HAVE_ZLIB
+// Sink compressing all bytes with gzip and forwarding the compressed data to `target`. Memory use is
+// bounded by the buffer capacity and zlib's internal state. finish() must be called (or the sink be
+// destroyed) before `target` is flushed or closed.
+class GzipSink : public Sink {
+public:
+    // `level` ranges from 1 (fastest) to 9 (smallest), -1 selects zlib's default (6).
+    explicit GzipSink(Sink & target_sink, int level = Z_DEFAULT_COMPRESSION, size_t buffer_capacity = DEFAULT_CAPACITY)
+        : Sink(buffer_capacity), target(target_sink), finished(false)
+    {
+        if (level < -1 || level > 9) {
+            throw std::invalid_argument("svg::GzipSink() requires a compression level in [-1, 9].");
+        }
+        std::memset(&stream, 0, sizeof(stream));
+        // Window bits 15 + 16 write a gzip (instead of a zlib) header and trailer:
+        if (deflateInit2(&stream, level, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+            failed = true;
+            finished = true;
+        }
+    }
+    virtual ~GzipSink() { finish(); }
+    void flush() override { deflateBuffer(Z_NO_FLUSH); }
+    // Compresses all pending bytes and writes the gzip trailer, returns \c true on success.
+    bool finish()
+    {
+        if (!finished) {
+            deflateBuffer(Z_FINISH);
+            deflateEnd(&stream);
+            finished = true;
+        }
+        return good() && target.good();
+    }
+private:
+    Sink & target;
+    z_stream stream;
+    bool finished;
+
+    void deflateBuffer(int mode)
+    {
+        if (finished) {
+            failed = failed || !buffer.empty();
+            buffer.clear();
+            return;
+        }
+        const size_t max_slice = size_t(1) << 30; // avail_in is (at least) 32 bits
+        size_t consumed = 0;
+        do {
+            const size_t n = std::min(max_slice, buffer.size() - consumed);
+            const int slice_mode = consumed + n == buffer.size() ? mode : Z_NO_FLUSH;
+            stream.next_in = reinterpret_cast<Bytef *>(&buffer[0] + consumed);
+            stream.avail_in = uInt(n);
+            char out[1 << 14];
+            do {
+                stream.next_out = reinterpret_cast<Bytef *>(out);
+                stream.avail_out = uInt(sizeof(out));
+                if (deflate(&stream, slice_mode) == Z_STREAM_ERROR) {
+                    failed = true;
+                    buffer.clear();
+                    return;
+                }
+                target.write(out, sizeof(out) - stream.avail_out);
+            } while (stream.avail_out == 0);
+            consumed += n;
+        } while (consumed < buffer.size());
+        buffer.clear();
+    }
+};
+#endif
+
+namespace internal {
+#ifdef SVG_WRITER_POSIX_IO
+    typedef FdSink OwnedFileSink;
+#else
+    typedef FileSink OwnedFileSink;
+#endif
+
+    // Writes chunks of bytes to a file on a background thread, in the order they were queued.
+    class AsyncFileWriter {
+    public:
+        // Starts the writer thread which opens `filename`.
+        static std::shared_ptr<AsyncFileWriter> start(const std::string &filename)
+        {
+            std::shared_ptr<AsyncFileWriter> writer(new AsyncFileWriter());
+            std::thread(&AsyncFileWriter::run, writer, filename).detach();
+            return writer;
+        }
+        std::future<bool> result() { return done.get_future(); }
+        void push(std::string chunk)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            chunks.push_back(std::move(chunk));
+            ready.notify_one();
+        }
+        // No more chunks follow.
+        void finish()
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            finished = true;
+            ready.notify_one();
+        }
+        // The document could not be serialized completely, the future becomes false.
+        void fail()
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            failed = true;
+        }
+    private:
+        std::mutex mutex;
+        std::condition_variable ready;
+        std::deque<std::string> chunks;
+        bool finished = false;
+        bool failed = false;
+        std::promise<bool> done;
+
+        AsyncFileWriter() { }
+        // The thread owns a reference to the writer, so it outlives the document and the sink.
+        static void run(std::shared_ptr<AsyncFileWriter> self, std::string filename)
+        {
+            OwnedFileSink file(filename, 0);
+            bool failed = false;
+            for (;;) {
+                std::string chunk;
+                {
+                    std::unique_lock<std::mutex> lock(self->mutex);
+                    self->ready.wait(lock, [&]() { return self->finished || !self->chunks.empty(); });
+                    if (self->chunks.empty()) {
+                        failed = self->failed;
+                        break;
+                    }
+                    chunk.swap(self->chunks.front());
+                    self->chunks.pop_front();
+                }
+                if (file.isOpen()) {
+                    file.write(chunk.data(), chunk.size());
+                    file.flush();
+                }
+            }
+            const bool closed = file.isOpen() && file.close();
+            self->done.set_value(closed && !failed);
+        }
+    };
+
+    // Sink handing every full buffer to an AsyncFileWriter, so formatting the next chunk overlaps
+    // with writing the previous one.
+    class AsyncFileSink : public Sink {
+    public:
+        AsyncFileSink(std::shared_ptr<AsyncFileWriter> file_writer, size_t buffer_capacity)
+            : Sink(buffer_capacity), writer(std::move(file_writer)) { }
+        virtual ~AsyncFileSink()
+        {
+            flush();
+            writer->finish();
+        }
+        void flush() override
+        {
+            if (!buffer.empty()) {
+                writer->push(std::move(buffer));
+                buffer = std::string();
+                buffer.reserve(capacity);
+            }
+        }
+    private:
+        std::shared_ptr<AsyncFileWriter> writer;
+    };
+}
+
 // Utility XML/String Functions.
 template <typename T>
 inline std::string attribute(std::string const & attribute_name,
@@ -75,6 +914,82 @@ inline std::string emptyElemEnd()
     return "/>\n";
 }
 
+namespace internal {
+    // Sets the output mode (see Sink::setCompact()) of a sink until destroyed, then restores the
+    // previous mode, style class and style cache of that sink.
+    class SinkModeScope {
+    public:
+        SinkModeScope(Sink & target, bool compact)
+            : sink(target), was_compact(target.isCompact()), style_class(target.styleClass()),
+              style_cache(target.styleCache())
+        {
+            sink.setCompact(compact);
+        }
+        ~SinkModeScope()
+        {
+            sink.setCompact(was_compact);
+            sink.setStyleClass(style_class);
+            sink.setStyleCache(style_cache);
+        }
+        SinkModeScope(const SinkModeScope &) = delete;
+        SinkModeScope & operator=(const SinkModeScope &) = delete;
+    private:
+        Sink & sink;
+        bool was_compact;
+        const char *style_class;
+        StyleCache *style_cache;
+    };
+}
+
+// Sink-based counterparts of the above, these avoid any temporary strings. In compact mode (see
+// Sink::isCompact()), attributes are preceded by (instead of followed by) a single space and
+// elements are neither indented nor followed by a line break.
+inline void attrStart(Sink & sink, const char *attribute_name)
+{
+    if (sink.isCss()) {
+        sink << attribute_name << ':';
+        return;
+    }
+    if (sink.isCompact()) {
+        sink << ' ';
+    }
+    sink << attribute_name << "=\"";
+}
+inline void attrEnd(Sink & sink)
+{
+    sink << (sink.isCss() ? ";" : (sink.isCompact() ? "\"" : "\" "));
+}
+template <typename T>
+inline void attribute(Sink & sink, const char *attribute_name, T const & value, const char *unit = "")
+{
+    attrStart(sink, attribute_name);
+    sink << value << unit;
+    attrEnd(sink);
+}
+inline void elemStart(Sink & sink, const char *element_name, bool single = false)
+{
+    if (sink.isCompact()) {
+        sink << '<' << element_name << (single ? ">" : "");
+    } else {
+        sink << "\t<" << element_name << (single ? ">\n" : " ");
+    }
+}
+inline void elemEnd(Sink & sink, const char *element_name)
+{
+    sink << "</" << element_name << (sink.isCompact() ? ">" : ">\n");
+}
+inline void emptyElemEnd(Sink & sink)
+{
+    sink << (sink.isCompact() ? "/>" : "/>\n");
+}
+// Writes formatting whitespace (omitted in compact mode).
+inline void whitespace(Sink & sink, const char *ws)
+{
+    if (!sink.isCompact()) {
+        sink << ws;
+    }
+}
+
 template<typename T, typename... Args>
 std::unique_ptr<T> make_unique(Args&&... args) {
     return std::unique_ptr<T>(new T(std::forward<Args>(args)...));
@@ -185,1282 +1100,3706 @@ inline optional<Point> getMaxPoint(std::vector<Point> const & points)
     return optional<Point>(max);
 }
 
-// Defines the dimensions, scale, origin, and origin offset of the document.
+// Precision of all coordinates and lengths written in SVG native space (that is, in pixels).
+struct Precision {
+    enum Mode {
+        Shortest, // shortest representation that reads back to the identical double (default)
+        Fixed,    // round to `decimal_places` decimal places
+        Adaptive  // round to as few decimal places as required to keep the error below `max_error` px
+    };
+
+    Precision(Mode precision_mode = Shortest, int places = 2, double max_px_error = 0.01)
+        : mode(precision_mode), decimal_places(places), max_error(max_px_error)
+    {
+        if (places < 0 || places > 15) {
+            throw std::invalid_argument("svg::Precision() requires decimal places in [0, 15].");
+        }
+        if (!valid_num(max_error) || max_error <= 0) {
+            throw std::invalid_argument("svg::Precision() requires a positive maximum error.");
+        }
+    }
+    static Precision shortest() { return Precision(Shortest); }
+    static Precision fixed(int places) { return Precision(Fixed, places); }
+    static Precision adaptive(double max_px_error = 0.01) { return Precision(Adaptive, 2, max_px_error); }
+
+    Mode mode;
+    int decimal_places;
+    double max_error;
+};
+
+// Defines the dimensions, scale, origin, origin offset, and coordinate precision of the document.
 struct Layout {
     enum Origin { TopLeft, BottomLeft, TopRight, BottomRight };
 
     Layout(Dimensions const & dims = Dimensions(400, 300), Origin orig = BottomLeft,
-        double dim_scale = 1, Point const & orig_offset = Point(0, 0))
-        : dimensions(dims), scale(dim_scale), origin(orig), origin_offset(orig_offset)
+        double dim_scale = 1, Point const & orig_offset = Point(0, 0),
+        Precision const & coord_precision = Precision())
+        : dimensions(dims), scale(dim_scale), origin(orig), origin_offset(orig_offset),
+          precision(coord_precision)
     {
       if (!valid_num(scale) || !valid_num(origin_offset.x) || !valid_num(origin_offset.y)) {
           std::cerr << "Infs or NaNs provided to svg::Layout()." << std::endl;
       }
+      update();
     }
     Dimensions dimensions;
     double scale;
     Origin origin;
     Point origin_offset;
+    Precision precision;
+
+    // Transformation from user to SVG native space: x' = bx + sx * (x + ox), y' likewise.
+    // This is equivalent to the origin-dependent formulas (bit by bit), just without branches.
+    struct Affine {
+        double sx, sy;
+        double ox, oy;
+        double bx, by;
+    };
+
+    void setPrecision(Precision const & p)
+    {
+        precision = p;
+        update();
+    }
+    // Number of decimal places coordinates are rounded to, -1 for the shortest round-trip representation.
+    int decimals() const
+    {
+        switch (precision.mode) {
+        case Precision::Fixed:
+            return precision.decimal_places;
+        case Precision::Adaptive: {
+            // The members are public, so the value computed by update() may be outdated:
+            const double extent = maxExtent();
+            if (precision.max_error == adaptive_max_error && extent == adaptive_extent) {
+                return adaptive_decimals;
+            }
+            return adaptiveDecimals(precision.max_error, extent);
+        }
+        default:
+            return -1;
+        }
+    }
+    // Derived from the public members on every call, so it is never outdated.
+    Affine affine() const
+    {
+        Affine a;
+        a.sx = flipsX() ? -scale : scale;
+        a.sy = flipsY() ? -scale : scale;
+        a.ox = origin_offset.x;
+        a.oy = origin_offset.y;
+        a.bx = flipsX() ? dimensions.width : 0.0;
+        a.by = flipsY() ? dimensions.height : 0.0;
+        return a;
+    }
+    // \c true if both layouts produce the same output.
+    bool operator==(Layout const & that) const
+    {
+        return dimensions.width == that.dimensions.width && dimensions.height == that.dimensions.height
+            && scale == that.scale && origin == that.origin && origin_offset.x == that.origin_offset.x
+            && origin_offset.y == that.origin_offset.y && decimals() == that.decimals();
+    }
+    bool operator!=(Layout const & that) const { return !(*this == that); }
+    bool flipsX() const { return origin == BottomRight || origin == TopRight; }
+    bool flipsY() const { return origin == BottomLeft || origin == BottomRight; }
+    /**
+     * \brief Precomputes the decimal places of Precision::Adaptive for the current members
+     * \note Optional, decimals() detects outdated values (and then computes them on every call).
+     */
+    void update()
+    {
+        adaptive_max_error = precision.max_error;
+        adaptive_extent = maxExtent();
+        adaptive_decimals = adaptiveDecimals(adaptive_max_error, adaptive_extent);
+    }
+private:
+    int adaptive_decimals;
+    double adaptive_max_error;
+    double adaptive_extent;
+
+    double maxExtent() const { return std::max(std::fabs(dimensions.width), std::fabs(dimensions.height)); }
+    // Rounding to d places is off by at most 0.5 * 10^-d px. Coordinates (in px, i.e., after scaling)
+    // mostly lie within the canvas, so digits beyond the 15 significant ones a double can represent
+    // are not worth writing.
+    static int adaptiveDecimals(double max_error, double extent)
+    {
+        const double needed = std::ceil(std::log10(0.5 / max_error));
+        const double integer_digits = extent >= 1 ? std::floor(std::log10(extent)) + 1 : 1;
+        return static_cast<int>(std::max(0.0, std::min(needed, 15.0 - integer_digits)));
+    }
 };
 
 // Convert coordinates in user space to SVG native space.
 inline double translateX(double x, Layout const & layout)
 {
-    if (layout.origin == Layout::BottomRight || layout.origin == Layout::TopRight) {
-        return layout.dimensions.width - ((x + layout.origin_offset.x) * layout.scale);
-    } else {
-        return (layout.origin_offset.x + x) * layout.scale;
-    }
+    const Layout::Affine a = layout.affine();
+    return a.bx + a.sx * (x + a.ox);
 }
 
 inline double translateY(double y, Layout const & layout)
 {
-    if (layout.origin == Layout::BottomLeft || layout.origin == Layout::BottomRight) {
-        return layout.dimensions.height - ((y + layout.origin_offset.y) * layout.scale);
-    } else {
-        return (layout.origin_offset.y + y) * layout.scale;
-    }
+    const Layout::Affine a = layout.affine();
+    return a.by + a.sy * (y + a.oy);
 }
 inline double translateScale(double dimension, Layout const & layout)
 {
     return dimension * layout.scale;
 }
 
-class Serializeable {
-public:
-    Serializeable() { }
-    virtual ~Serializeable() { }
-    virtual std::string toString(Layout const & l) const = 0;
+// Coordinate (or length) in SVG native space, written to a Sink with the precision of its layout.
+struct Coordinate {
+    Coordinate(double v, int places) : value(v), decimals(places) { }
+    double value;
+    int decimals;
 };
+inline Sink & operator<<(Sink & sink, Coordinate const & c) { return sink.writeFixed(c.value, c.decimals); }
 
-class Identifiable {
-public:
-  Identifiable(const std::string &identifier = {}) : id(identifier) { }
-  virtual ~Identifiable() { }
-  const std::string& getId() const { return id; }
-  void setId(const std::string &new_id = {}) { id = new_id; }
-  static std::string random(size_t len = 8)
-  {
-      std::string tmp_s;
-      static const char alphanum[] = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz";
-
-      static bool init_once = false;
-      if (!init_once) { // one-shot initialization upon first entering
-        std::srand(unsigned(time(nullptr)));
-        init_once = true;
-      }
-      tmp_s.reserve(len);
-      for (size_t i = 0; i < len; ++i) {
-          tmp_s += alphanum[unsigned(rand()) % (sizeof(alphanum) - 1)];
-      }
-      return tmp_s;
-  }
-protected:
-  std::string id;
-  std::string serializeId() const
-  {
-    if (id.empty()) {
-      return {};
-    } else {
-      return attribute("id", id);
-    }
-  }
-};
+// Same as translateX(), translateY() and translateScale() but keep the layout's precision.
+inline Coordinate coordX(double x, Layout const & layout) { return Coordinate(translateX(x, layout), layout.decimals()); }
+inline Coordinate coordY(double y, Layout const & layout) { return Coordinate(translateY(y, layout), layout.decimals()); }
+inline Coordinate coordScale(double dimension, Layout const & layout)
+{
+    return Coordinate(translateScale(dimension, layout), layout.decimals());
+}
 
-class Color : public Serializeable {
-public:
-    enum Defaults { Transparent = -1, Aqua, Black, Gray, Blue, Brown, Cyan, Fuchsia,
-        Green, Lime, Magenta, Orange, Purple, Red, Silver, White, Yellow, Random };
+namespace internal {
+    // Batch transformation of `n` points into native space, `out` receives x0, y0, x1, y1, ...
+    // All variants compute bx + sx * (x + ox) (respectively bx - |sx| * (x + ox)) in the same
+    // order of operations, so their results are identical bit by bit.
 
-    Color(unsigned char r, unsigned char g, unsigned char b) : transparent(false), red(r), green(g), blue(b) { }
-    Color(Defaults color)
-        : transparent(false), red(0), green(0), blue(0)
+    // Origin-specialized scalar fallback, the flips and the offsets fold into constants.
+    template <bool FLIP_X, bool FLIP_Y>
+    inline void transformPointsScalar(const Point *points, size_t n, Layout::Affine const & a, double *out)
     {
-        switch (color) {
-        case Aqua:    assign(  0, 255, 255); break;
-        case Black:   assign(  0,   0,   0); break;
-        case Gray:    assign(127, 127, 127); break;
-        case Blue:    assign(  0,   0, 255); break;
-        case Brown:   assign(165,  42,  42); break;
-        case Cyan:    assign(  0, 255, 255); break;
-        case Fuchsia: assign(255,   0, 255); break;
-        case Green:   assign(  0, 128,   0); break;
-        case Lime:    assign(  0, 255,   0); break;
-        case Magenta: assign(255,   0, 255); break;
-        case Orange:  assign(255, 165,   0); break;
-        case Purple:  assign(128,   0, 128); break;
-        case Red:     assign(255,   0,   0); break;
-        case Silver:  assign(192, 192, 192); break;
-        case White:   assign(255, 255, 255); break;
-        case Yellow:  assign(255, 255,   0); break;
-        case Random:
-          static bool srand_init = false;
-          if (!srand_init) {
-              srand(static_cast<unsigned int>(time(nullptr)));
-              srand_init = true;
-          }
-          assign(rand() % 256, rand() % 256, rand() % 256);
-          break;
-        case Transparent: // fall through...
-        default: transparent = true; break;
+        const double scale = FLIP_X ? -a.sx : a.sx; // == Layout::scale
+        for (size_t i = 0; i < n; ++i) {
+            const double x = scale * (points[i].x + a.ox);
+            const double y = scale * (points[i].y + a.oy);
+            out[2 * i] = FLIP_X ? a.bx - x : x;
+            out[2 * i + 1] = FLIP_Y ? a.by - y : y;
         }
     }
-    virtual ~Color() { }
-    std::string toString(Layout const &) const
+
+    inline void transformPointsScalar(const Point *points, size_t n, Layout const & layout, double *out)
     {
-        std::stringstream ss;
-        if (transparent) {
-            ss << "none";
-        } else {
-            ss << "rgb(" << red << "," << green << "," << blue << ")";
+        const Layout::Affine a = layout.affine();
+        switch (layout.origin) {
+        case Layout::TopLeft:     transformPointsScalar<false, false>(points, n, a, out); break;
+        case Layout::BottomLeft:  transformPointsScalar<false, true>(points, n, a, out); break;
+        case Layout::TopRight:    transformPointsScalar<true, false>(points, n, a, out); break;
+        case Layout::BottomRight: transformPointsScalar<true, true>(points, n, a, out); break;
         }
-        return ss.str();
     }
-private:
-    bool transparent;
-    int red;
-    int green;
-    int blue;
 
-    void assign(int r, int g, int b) { red = r; green = g; blue = b; }
-};
+#ifdef SVG_WRITER_X86_SIMD
+    // One point (x, y) per SSE2 register.
+    inline void transformPointsSse2(const Point *points, size_t n, Layout::Affine const & a, double *out)
+    {
+        const __m128d offset = _mm_set_pd(a.oy, a.ox);
+        const __m128d scale = _mm_set_pd(a.sy, a.sx);
+        const __m128d base = _mm_set_pd(a.by, a.bx);
+        for (size_t i = 0; i < n; ++i) {
+            const __m128d p = _mm_add_pd(_mm_loadu_pd(&points[i].x), offset);
+            _mm_storeu_pd(out + 2 * i, _mm_add_pd(base, _mm_mul_pd(scale, p)));
+        }
+    }
 
-class Fill : public Serializeable {
-public:
-    Fill(Color::Defaults fill_color, double opacity_level = 1.0)
-        : color(fill_color), opacity(opacity_level)
+    // Two points per AVX register. Deliberately compiled without FMA which would change the rounding.
+    __attribute__((target("avx")))
+    inline void transformPointsAvx(const Point *points, size_t n, Layout::Affine const & a, double *out)
     {
-        if (opacity_level < 0 || opacity_level > 1) {
-            std::cerr << "Fill::Fill(): opacity_level=" << opacity_level << " is out of range [0,1]." << std::endl;
+        const __m256d offset = _mm256_set_pd(a.oy, a.ox, a.oy, a.ox);
+        const __m256d scale = _mm256_set_pd(a.sy, a.sx, a.sy, a.sx);
+        const __m256d base = _mm256_set_pd(a.by, a.bx, a.by, a.bx);
+        size_t i = 0;
+        for (; i + 2 <= n; i += 2) {
+            const __m256d p = _mm256_add_pd(_mm256_loadu_pd(&points[i].x), offset);
+            _mm256_storeu_pd(out + 2 * i, _mm256_add_pd(base, _mm256_mul_pd(scale, p)));
         }
+        transformPointsSse2(points + i, n - i, a, out + 2 * i);
     }
-    Fill(Color fill_color = Color::Transparent)
-        : color(fill_color), opacity(1.0) { }
-    std::string toString(Layout const & l) const
+
+    inline bool cpuSupportsAvx()
     {
-        std::stringstream ss;
-        ss << attribute("fill", color.toString(l));
-        if (opacity < 1.0) {
-            ss << attribute("fill-opacity", opacity);
+        static const bool supported = __builtin_cpu_supports("avx");
+        return supported;
+    }
+#endif
+
+    // Dispatches to the best kernel supported by the CPU at runtime.
+    inline void transformPoints(const Point *points, size_t n, Layout const & layout, double *out)
+    {
+#ifdef SVG_WRITER_X86_SIMD
+        if (cpuSupportsAvx()) {
+            transformPointsAvx(points, n, layout.affine(), out);
+        } else {
+            transformPointsSse2(points, n, layout.affine(), out);
         }
-        return ss.str();
+#else
+        transformPointsScalar(points, n, layout, out);
+#endif
     }
-private:
-    Color color;
-    double opacity; // in [0, 1], 1 = fully visible, 0 = fully transparent
-};
+}
 
-class Stroke : public Serializeable {
-public:
-    Stroke(double w = -1, Color stroke_color = Color::Transparent, bool nonScalingStroke = false,
-           double stroke_miterlimit = -1, std::vector<unsigned> stroke_dasharray = {},
-           unsigned int stroke_dashoffset = 0, double stroke_opacity = 1.0)
-        : width(w), color(stroke_color), nonScaling(nonScalingStroke),
-          miterlimit(stroke_miterlimit), dasharray(stroke_dasharray),
-          dashoffset(stroke_dashoffset), opacity(stroke_opacity)
+namespace internal {
+    // Transformation of coordinate columns, the loops are trivially vectorizable.
+    inline void transformColumns(const double *xs, const double *ys, size_t n, Layout::Affine const & a,
+                                 double *tx, double *ty)
     {
-        if (!valid_num(width) || !valid_num(stroke_miterlimit) ||
-            !valid_num(stroke_opacity)) {
-            std::cerr << "Infs or NaNs provided to svg::Stroke()." << std::endl;
+        for (size_t i = 0; i < n; ++i) {
+            tx[i] = a.bx + a.sx * (xs[i] + a.ox);
         }
-        if (stroke_opacity < 0 || stroke_opacity > 1) {
-            std::cerr << "Stroke::Stroke(): stroke_opacity=" << stroke_opacity << " is out of range [0,1]." << std::endl;
+        for (size_t i = 0; i < n; ++i) {
+            ty[i] = a.by + a.sy * (ys[i] + a.oy);
         }
     }
-    std::string toString(Layout const & l) const
+
+    // Formats `n` transformed points (x[i * stride], y[i * stride]) as "x,y " pairs into `text`.
+    inline size_t formatPoints(const double *x, const double *y, size_t stride, size_t n, int decimals, char *text)
     {
-        // If stroke width is invalid.
-        if (width < 0) {
-            return std::string();
+        char *p = text;
+        for (size_t i = 0; i < n * stride; i += stride) {
+            p += formatCoordinate(x[i], decimals, p);
+            *p++ = ',';
+            p += formatCoordinate(y[i], decimals, p);
+            *p++ = ' ';
         }
+        return size_t(p - text);
+    }
 
-        std::stringstream ss;
-        ss << attribute("stroke-width", translateScale(width, l))
-           << attribute("stroke", color.toString(l));
-        if (miterlimit >= 0) {
-            ss << attribute("stroke-miterlimit", translateScale(miterlimit, l));
-        }
-        ss << attribute("stroke-dashoffset", translateScale(dashoffset, l));
-        std::stringstream tmp;
-        for (size_t i = 0; i < dasharray.size(); ++i) {
-            tmp << dasharray[i];
-            if (i + 1 < dasharray.size()) {
-                tmp << ",";
-            }
-        }
-        if (!dasharray.empty()) {
-            ss << attribute("stroke-dasharray", tmp.str());
+    // Points are transformed and formatted in chunks, each of which is appended to the sink at once.
+    static const size_t POINT_CHUNK_SIZE = 128;
+}
+
+// Writes `n` points as "x,y " pairs in SVG native space. In compact mode, the final space is dropped
+// unless more points of the same list follow in another call (`last_chunk` is \c false).
+inline void writePoints(Sink & sink, const Point *points, size_t n, Layout const & layout,
+                        bool last_chunk = true)
+{
+    double xy[2 * internal::POINT_CHUNK_SIZE];
+    char text[2 * internal::POINT_CHUNK_SIZE * 32];
+    const bool trim = sink.isCompact() && last_chunk;
+    for (size_t first = 0; first < n; first += internal::POINT_CHUNK_SIZE) {
+        const size_t count = std::min(internal::POINT_CHUNK_SIZE, n - first);
+        internal::transformPoints(points + first, count, layout, xy);
+        const size_t length = internal::formatPoints(xy, xy + 1, 2, count, layout.decimals(), text);
+        sink.write(text, trim && first + count == n ? length - 1 : length);
+    }
+}
+
+// Writes `n` points given as separate x/y columns like the above.
+inline void writePoints(Sink & sink, const double *xs, const double *ys, size_t n, Layout const & layout,
+                        bool last_chunk = true)
+{
+    double tx[internal::POINT_CHUNK_SIZE];
+    double ty[internal::POINT_CHUNK_SIZE];
+    char text[2 * internal::POINT_CHUNK_SIZE * 32];
+    const bool trim = sink.isCompact() && last_chunk;
+    for (size_t first = 0; first < n; first += internal::POINT_CHUNK_SIZE) {
+        const size_t count = std::min(internal::POINT_CHUNK_SIZE, n - first);
+        internal::transformColumns(xs + first, ys + first, count, layout.affine(), tx, ty);
+        const size_t length = internal::formatPoints(tx, ty, 1, count, layout.decimals(), text);
+        sink.write(text, trim && first + count == n ? length - 1 : length);
+    }
+}
+
+// Structure-of-arrays point container: x and y coordinates are kept in separate, contiguous arrays.
+// Data that is already available column-wise can be appended without any conversion.
+class PointColumns {
+public:
+    PointColumns() { }
+    PointColumns(std::vector<double> x_values, std::vector<double> y_values)
+        : xs(std::move(x_values)), ys(std::move(y_values))
+    {
+        if (xs.size() != ys.size()) {
+            throw std::invalid_argument("svg::PointColumns() requires columns of equal length.");
         }
-        if (opacity < 1.0) {
-            ss << attribute("stroke-opacity", opacity);
+    }
+    size_t size() const { return xs.size(); }
+    bool empty() const { return xs.empty(); }
+    void reserve(size_t n)
+    {
+        xs.reserve(n);
+        ys.reserve(n);
+    }
+    void push_back(Point const & point)
+    {
+        xs.push_back(point.x);
+        ys.push_back(point.y);
+    }
+    void append(const double *x_values, const double *y_values, size_t n)
+    {
+        xs.insert(xs.end(), x_values, x_values + n);
+        ys.insert(ys.end(), y_values, y_values + n);
+    }
+    Point operator[](size_t i) const { return Point(xs[i], ys[i]); }
+    const double *xData() const { return xs.data(); }
+    const double *yData() const { return ys.data(); }
+    void offset(Point const & offset)
+    {
+        for (size_t i = 0; i < xs.size(); ++i) {
+            xs[i] += offset.x;
         }
-        if (nonScaling) {
-           ss << attribute("vector-effect", "non-scaling-stroke");
+        for (size_t i = 0; i < ys.size(); ++i) {
+            ys[i] += offset.y;
         }
-        return ss.str();
     }
 private:
-    double width;
-    Color color;
-    bool nonScaling;
-    double miterlimit;
-    std::vector<unsigned> dasharray;
-    unsigned dashoffset;
-    double opacity; // in [0, 1], 1 = fully visible, 0 = fully transparent
+    std::vector<double> xs;
+    std::vector<double> ys;
 };
 
-class Font : public Serializeable {
+// Non-owning view of caller-owned coordinates: point i is (xs[i * stride], ys[i * stride]), with
+// double or float components. Interleaved x/y data is viewed as PointView(data, data + 1, n, 2).
+// The referenced memory must stay valid and unchanged as long as any shape refers to it.
+class PointView {
 public:
-    Font(double font_size = 12, std::string const & font_family = "Verdana")
-        : size(font_size), family(font_family) { }
-    std::string toString(Layout const & l) const
+    PointView() : x_data(0), y_data(0), count(0), stride(1), single(false) { }
+    PointView(const double *xs, const double *ys, size_t n, size_t element_stride = 1)
+        : x_data(xs), y_data(ys), count(n), stride(element_stride), single(false) { }
+    PointView(const float *xs, const float *ys, size_t n, size_t element_stride = 1)
+        : x_data(xs), y_data(ys), count(n), stride(element_stride), single(true) { }
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+    Point operator[](size_t i) const
     {
-        std::stringstream ss;
-        ss << attribute("font-size", translateScale(size, l)) << attribute("font-family", family);
-        return ss.str();
+        return single ? Point(static_cast<const float *>(x_data)[i * stride], static_cast<const float *>(y_data)[i * stride])
+                      : Point(static_cast<const double *>(x_data)[i * stride], static_cast<const double *>(y_data)[i * stride]);
     }
-    double getSize() const { return size; }
-    void setSize(double s) { size = s; }
-    const std::string &getFamily() const { return family; }
-    void setFamily(const std::string &f) { family = f; }
-private:
-    double size;
-    std::string family;
-};
-
-// All SVG entities (shapes) than have a stroke (that is, Line, Polyline, and all listed for "SurfaceShape")
-class Shape : public Serializeable, public Identifiable {
-public:
-    Shape(Stroke const & stroke_style = Stroke(), int z_order = 0, const std::string& shape_id = {})
-        : Identifiable(shape_id), z(z_order), stroke(stroke_style) { }
-    virtual ~Shape() { }
-    std::string toString(Layout const & l) const override
+    // Copies the points [first, first + n) to separate x/y arrays, translated by `offset`.
+    void gather(size_t first, size_t n, Point const & offset, double *xs, double *ys) const
     {
-        std::stringstream ss;
-        ss << stroke.toString(l);
-        if (!style.empty()) {
-            ss << attribute("style", style);
-        }
-        if (!visible) {
-            ss << attribute("visibility", "hidden");
+        if (single) {
+            gather(static_cast<const float *>(x_data), static_cast<const float *>(y_data), first, n, offset, xs, ys);
+        } else {
+            gather(static_cast<const double *>(x_data), static_cast<const double *>(y_data), first, n, offset, xs, ys);
         }
-        return ss.str();
     }
-    virtual void offset(Point const & offset) = 0;
-    virtual std::unique_ptr<Shape> clone() const = 0;
-    Stroke getStroke() const { return stroke; }
-    const std::string& getStyle() const { return style; }
-    void setStroke(Stroke s) { stroke = s; }
-    void setStyle(const std::string &new_style) { style = new_style; }
-    bool isVisible() const { return visible; }
-    void hide() { visible = false; }
-    void show() { visible = true; }
-    /**
-     * z order of SVG elements in the document. Default is zero which equals the order of insertion, that is,
-     * an element A that is inserted after an element B overlays it because A is drawn after (and possibly over) B.
-     * If all elements are zero, the default library behavior is applied (according to the SVG standard) and
-     * elements are not reordered before they are written to the SVG file.
-     * Elements (aka Shape's) with a smaller (and also possibly a negative) `z` are added/drawn before others with a larger z.
-     * That means, if you want an element A to be above/over an element B, set something like A.z > B.z. Alternatively, set
-     * A.z = B.z (or simply don't change it at all but then you have to ensure to add B *first*, then A.
-     */
-    int z;
-protected:
-    Stroke stroke;
-    std::string style;
-    bool visible = true;
-};
+private:
+    const void *x_data;
+    const void *y_data;
+    size_t count;
+    size_t stride;
+    bool single;
 
-// All SVG entities (shapes) that can be filled (that is, Circle, Ellipse, Rectangle, Polygon, Path, and Text)
-class SurfaceShape : public Shape {
-public:
-    SurfaceShape(Fill const & fill_style = Fill(), Stroke const & stroke_style = Stroke(), int z_order = 0, const std::string& shape_id = {})
-        : Shape(stroke_style, z_order, shape_id), fill(fill_style) { }
-    std::string toString(Layout const & l) const override
+    template <typename T>
+    void gather(const T *x_values, const T *y_values, size_t first, size_t n, Point const & offset,
+                double *xs, double *ys) const
     {
-        return Shape::toString(l) + fill.toString(l);
+        for (size_t i = 0; i < n; ++i) {
+            xs[i] = double(x_values[(first + i) * stride]) + offset.x;
+            ys[i] = double(y_values[(first + i) * stride]) + offset.y;
+        }
     }
-    void setFill(Fill f) { fill = f; }
-    Fill getFill() const { return fill; }
-protected:
-    Fill fill;
-    virtual ~SurfaceShape() { }
 };
 
-class Marker : public Serializeable, public Identifiable {
+// Vertex storage of Polyline, Polygon and Path: an array of points (default), separate x/y columns
+// if constructed from PointColumns or a non-owning PointView. Only the active representation is
+// stored. Offsets of a view are accumulated and applied on output; appending to a view copies it
+// into owned columns first.
+class PointBuffer {
 public:
-    // Creates an empty marker (no visual effect).
-    Marker() : orient("auto") { }
-    Marker(const std::string &markerId, double markerWidth, double markerHeight, double refX, double refY,
-           const Shape &shape, const std::string &orientation = "auto")
-        : Identifiable(markerId), marker_width(markerWidth), marker_height(markerHeight), ref_x(refX),
-          ref_y(refY), orient(orientation)
+    enum Storage { Points, Columns, View };
+
+    PointBuffer() : storage(Points) { new (&points) std::vector<Point>(); }
+    PointBuffer(std::vector<Point> pts) : storage(Points) { new (&points) std::vector<Point>(std::move(pts)); }
+    PointBuffer(PointColumns cols) : storage(Columns) { new (&columns) PointColumns(std::move(cols)); }
+    PointBuffer(PointView const & pts) : storage(View) { new (&view) ViewData(pts); }
+    PointBuffer(PointBuffer const & that) : storage(that.storage) { construct(that); }
+    PointBuffer(PointBuffer && that) noexcept : storage(that.storage) { construct(std::move(that)); }
+    PointBuffer & operator=(PointBuffer const & that)
     {
-        *this << shape;
+        if (this != &that) {
+            PointBuffer copy(that);
+            *this = std::move(copy);
+        }
+        return *this;
     }
-    Marker(const Marker &that) : Identifiable(that.id)
+    PointBuffer & operator=(PointBuffer && that) noexcept
     {
-        shapes.reserve(that.shapes.size());
-        for (size_t i = 0; i < that.shapes.size(); ++i) {
-            shapes.push_back(that.shapes[i]->clone());
+        if (this != &that) {
+            destroy();
+            storage = that.storage;
+            construct(std::move(that));
         }
-        id = that.id;
-        marker_width = that.marker_width;
-        marker_height = that.marker_height;
-        ref_x = that.ref_x;
-        ref_y = that.ref_y;
-        orient = that.orient;
+        return *this;
     }
-    Marker(Marker &&that)
+    ~PointBuffer() { destroy(); }
+    Storage getStorage() const { return storage; }
+    bool isColumnar() const { return storage == Columns; }
+    size_t size() const
     {
-        shapes.reserve(that.shapes.size());
-        for (size_t i = 0; i < that.shapes.size(); ++i) {
-            shapes.push_back(std::move(that.shapes[i]));
+        switch (storage) {
+            case Columns: return columns.size();
+            case View: return view.data.size();
+            default: return points.size();
         }
-        that.shapes.clear();
-
-        id = that.id;
-        that.id.clear();
-        marker_width = that.marker_width;
-        marker_height = that.marker_height;
-        ref_x = that.ref_x;
-        ref_y = that.ref_y;
-        orient = that.orient;
     }
-    Marker& operator=(Marker &that)
+    bool empty() const { return size() == 0; }
+    // Removes all points, a view is replaced by an empty array of points.
+    void clear()
     {
-        if (this != &that) {
-            shapes.reserve(that.shapes.size());
-            for (size_t i = 0; i < that.shapes.size(); ++i) {
-                shapes.push_back(that.shapes[i]->clone());
-            }
-            id = that.id;
-            marker_width = that.marker_width;
-            marker_height = that.marker_height;
-            ref_x = that.ref_x;
-            ref_y = that.ref_y;
-            orient = that.orient;
+        if (storage == Columns) {
+            columns = PointColumns();
+        } else {
+            *this = PointBuffer();
         }
-        return *this;
     }
-    Marker& operator=(Marker &&that)
+    std::vector<Point> toVector() const
     {
-        if (this != &that) {
-            shapes.reserve(that.shapes.size());
-            for (size_t i = 0; i < that.shapes.size(); ++i) {
-                shapes.push_back(std::move(that.shapes[i]));
-            }
-            that.shapes.clear();
-
-            id = that.id;
-            that.id.clear();
-            marker_width = that.marker_width;
-            marker_height = that.marker_height;
-            ref_x = that.ref_x;
-            ref_y = that.ref_y;
-            orient = that.orient;
+        std::vector<Point> result(size());
+        for (size_t i = 0; i < result.size(); ++i) {
+            result[i] = (*this)[i];
         }
-        return *this;
+        return result;
     }
-    Marker& operator<<(const Shape &shape)
+    void reserve(size_t n)
     {
-        shapes.push_back(shape.clone());
-        return *this;
+        detach();
+        if (storage == Columns) {
+            columns.reserve(n);
+        } else {
+            points.reserve(n);
+        }
     }
-    std::string toString(Layout const &) const override
+    void push_back(Point const & point)
     {
-        if (id.empty()) {
-            throw std::invalid_argument("svg::Marker::toString() requires a non-empty ID to refer to that marker.");
+        detach();
+        if (storage == Columns) {
+            columns.push_back(point);
+        } else {
+            points.push_back(point);
         }
-
-        // Don't add any translation:
-        const Layout UNCHANGED(Dimensions(), Layout::TopLeft);
-
-        std::stringstream ss;
-        if (valid()) { // only if not empty / defined
-            ss << "\t" << elemStart("marker")
-               << serializeId()
-               << attribute("markerWidth", marker_width)
-               << attribute("markerHeight", marker_height)
-               << attribute("refX", ref_x)
-               << attribute("refY", ref_y)
-               << attribute("orient", orient) << ">\n";
-            for (size_t i = 0; i < shapes.size(); ++i) {
-                ss << "\t\t" << shapes[i]->toString(UNCHANGED);
-                if (i + 1 < shapes.size()) {
-                    ss << "\n";
-                }
+    }
+    // Appends `n` points given as separate x/y arrays.
+    void append(const double *xs, const double *ys, size_t n)
+    {
+        detach();
+        if (storage == Columns) {
+            columns.append(xs, ys, n);
+        } else {
+            points.reserve(points.size() + n);
+            for (size_t i = 0; i < n; ++i) {
+                points.push_back(Point(xs[i], ys[i]));
             }
-            ss << "\t\t" << elemEnd("marker");
         }
-        return ss.str();
     }
-    bool valid() const { return !id.empty(); }
-    std::unique_ptr<Shape>& operator[](size_t index) { return shapes[index]; }
-    size_t size() const { return shapes.size(); }
-    // Checks if \c *this is \a visually not equal to \c that. \c id is \a not considered.
-    // This is used in svg::Document to test for Marker ID collisions.
-    bool operator!=(const Marker &that) const
+    // Appends the points [first, last), storage is reserved up front for forward iterators.
+    template <typename InputIt>
+    void append(InputIt first, InputIt last)
     {
-        if (shapes.size() != that.shapes.size() || !equal(marker_width, that.marker_width) ||
-            !equal(ref_x, that.ref_x) || !equal(marker_height, that.marker_height) ||
-            !equal(ref_y, that.ref_y)) {
-            return true;
+        append(first, last, typename std::iterator_traits<InputIt>::iterator_category());
+    }
+    // Number of points in [first, last) with an Inf or NaN coordinate.
+    size_t countInvalid(size_t first, size_t last) const
+    {
+        // x - x is NaN for Infs and NaNs and 0 otherwise, this keeps the loops branch-free.
+        size_t invalid = 0;
+        if (storage == Columns) {
+            const double *xs = columns.xData();
+            const double *ys = columns.yData();
+            for (size_t i = first; i < last; ++i) {
+                invalid += !((xs[i] - xs[i]) + (ys[i] - ys[i]) == 0);
+            }
+        } else if (storage == View) {
+            for (size_t i = first; i < last; ++i) {
+                const Point p = view.data[i];
+                invalid += !((p.x - p.x) + (p.y - p.y) == 0);
+            }
+        } else {
+            for (size_t i = first; i < last; ++i) {
+                invalid += !((points[i].x - points[i].x) + (points[i].y - points[i].y) == 0);
+            }
         }
-        // Convert all shapes to strings, sort them to make the comparison independent of the
-        // order:
-        const Layout DUMMY;
-        std::vector<std::string> str_shapes[2];
-        str_shapes[0].resize(shapes.size());
-        str_shapes[1].resize(shapes.size());
-        for (size_t i = 0; i < shapes.size(); ++i) {
-            str_shapes[0][i] = shapes[i]->toString(DUMMY);
-            str_shapes[1][i] = that.shapes[i]->toString(DUMMY);
+        return invalid;
+    }
+    Point operator[](size_t i) const
+    {
+        switch (storage) {
+            case Columns: return columns[i];
+            case View: return Point(view.data[i].x + view.offset.x, view.data[i].y + view.offset.y);
+            default: return points[i];
         }
-        std::sort(str_shapes[0].begin(), str_shapes[0].end());
-        std::sort(str_shapes[1].begin(), str_shapes[1].end());
-        for (size_t i = 0; i < shapes.size(); ++i) {
-            if (str_shapes[0][i] != str_shapes[1][i]) {
-                return true;
+    }
+    void offset(Point const & offset)
+    {
+        if (storage == Columns) {
+            columns.offset(offset);
+        } else if (storage == View) {
+            view.offset.x += offset.x;
+            view.offset.y += offset.y;
+        } else {
+            for (size_t i = 0; i < points.size(); ++i) {
+                points[i].x += offset.x;
+                points[i].y += offset.y;
             }
         }
-        return false;
     }
-    void setOrientation(const std::string orientation = "auto")
+    // Component-wise minimum and maximum of all points (invalid if empty).
+    optional<Point> minPoint() const { return bound(true); }
+    optional<Point> maxPoint() const { return bound(false); }
+    // Writes the points [first, last) as "x,y " pairs in SVG native space.
+    void writeTo(Sink & sink, Layout const & layout, size_t first, size_t last) const
     {
-        if (orientation != "auto" && orientation != "auto-start-reverse") {
-            throw std::invalid_argument("Marker::setOrientation() only accepts the strings \"auto\" or \"auto-start-reverse\".");
+        if (storage == Columns) {
+            writePoints(sink, columns.xData() + first, columns.yData() + first, last - first, layout);
+        } else if (storage == View) {
+            double xs[internal::POINT_CHUNK_SIZE];
+            double ys[internal::POINT_CHUNK_SIZE];
+            for (size_t i = first; i < last; i += internal::POINT_CHUNK_SIZE) {
+                const size_t count = std::min(internal::POINT_CHUNK_SIZE, last - i);
+                view.data.gather(i, count, view.offset, xs, ys);
+                writePoints(sink, xs, ys, count, layout, i + count == last);
+            }
+        } else {
+            writePoints(sink, points.data() + first, last - first, layout);
         }
-        orient = orientation;
     }
-    void setOrientation(double angle) { orient = std::to_string(angle); }
+    void writeTo(Sink & sink, Layout const & layout) const { writeTo(sink, layout, 0, size()); }
 private:
-    std::vector<std::unique_ptr<Shape>> shapes;
-    double marker_width;
-    double marker_height;
-    double ref_x;
-    double ref_y;
-    std::string orient;
-};
-
-namespace internal {
-    auto compareMarker = [](const Marker *a, const Marker *b) { return a->getId() < b->getId(); };
-    typedef std::set<const Marker*, decltype(compareMarker)> MarkerSet;
-}
+    struct ViewData {
+        explicit ViewData(PointView const & pts) : data(pts) { }
+        PointView data;
+        Point offset;
+    };
+    union {
+        std::vector<Point> points;
+        PointColumns columns;
+        ViewData view;
+    };
+    Storage storage;
 
-class Markerable : public Serializeable {
-public:
-    Markerable() : marker_start(nullptr), marker_mid(nullptr), marker_end(nullptr) { }
-    void setStartMarker(const Marker *m) { marker_start = m; }
-    void setMidMarker(const Marker *m) { marker_mid = m; }
-    void setEndMarker(const Marker *m) { marker_end = m; }
-    std::string toString(Layout const &) const override
+    // Constructs the member `storage` refers to from that of `that`.
+    template <typename Other>
+    void construct(Other && that)
     {
-        std::stringstream ss;
-        if (marker_start && marker_start->valid()) {
-            ss << "marker-start=\"url(#" << marker_start->getId() << ")\" ";
+        switch (storage) {
+            case Columns: new (&columns) PointColumns(std::forward<Other>(that).columns); break;
+            case View: new (&view) ViewData(that.view); break;
+            default: new (&points) std::vector<Point>(std::forward<Other>(that).points); break;
         }
-        if (marker_mid && marker_mid->valid()) {
-            ss << "marker-mid=\"url(#" << marker_mid->getId() << ")\" ";
+    }
+    void destroy()
+    {
+        switch (storage) {
+            case Columns: columns.~PointColumns(); break;
+            case View: view.~ViewData(); break;
+            default: points.~vector(); break;
         }
-        if (marker_end && marker_end->valid()) {
-            ss << "marker-end=\"url(#" << marker_end->getId() << ")\" ";
+    }
+
+    // Turns a view into owned columns before it is modified.
+    void detach()
+    {
+        if (storage != View) {
+            return;
         }
-        return ss.str();
+        std::vector<double> xs(view.data.size());
+        std::vector<double> ys(view.data.size());
+        view.data.gather(0, view.data.size(), view.offset, xs.data(), ys.data());
+        view.~ViewData();
+        new (&columns) PointColumns(std::move(xs), std::move(ys));
+        storage = Columns;
     }
-    internal::MarkerSet getUsedMarkers() const
+    template <typename InputIt>
+    void append(InputIt first, InputIt last, std::input_iterator_tag)
     {
-        internal::MarkerSet result(internal::compareMarker);
-        if (marker_start && marker_start->valid()) {
-            result.insert(marker_start);
+        for (; first != last; ++first) {
+            push_back(*first);
         }
-        if (marker_mid && marker_mid->valid()) {
-            result.insert(marker_mid);
+    }
+    template <typename ForwardIt>
+    void append(ForwardIt first, ForwardIt last, std::forward_iterator_tag)
+    {
+        reserve(size() + size_t(std::distance(first, last)));
+        append(first, last, std::input_iterator_tag());
+    }
+    optional<Point> bound(bool minimum) const
+    {
+        if (empty()) {
+            return {};
         }
-        if (marker_end && marker_end->valid()) {
-            result.insert(marker_end);
+        if (storage == Points) {
+            return minimum ? getMinPoint(points) : getMaxPoint(points);
         }
-        return result;
+        if (storage == View) {
+            Point result = (*this)[0];
+            for (size_t i = 1; i < view.data.size(); ++i) {
+                const Point p = (*this)[i];
+                result.x = minimum ? std::min(result.x, p.x) : std::max(result.x, p.x);
+                result.y = minimum ? std::min(result.y, p.y) : std::max(result.y, p.y);
+            }
+            return optional<Point>(result);
+        }
+        Point result = columns[0];
+        const double *xs = columns.xData();
+        const double *ys = columns.yData();
+        for (size_t i = 0; i < columns.size(); ++i) {
+            result.x = minimum ? std::min(result.x, xs[i]) : std::max(result.x, xs[i]);
+        }
+        for (size_t i = 0; i < columns.size(); ++i) {
+            result.y = minimum ? std::min(result.y, ys[i]) : std::max(result.y, ys[i]);
+        }
+        return optional<Point>(result);
     }
-
-private:
-    const Marker *marker_start;
-    const Marker *marker_mid;
-    const Marker *marker_end;
 };
 
-template <typename T>
-inline std::string vectorToString(std::vector<T> collection, Layout const & layout)
-{
-    std::string combination_str;
-    for (unsigned i = 0; i < collection.size(); ++i) {
-        combination_str += collection[i].toString(layout);
+/**
+ * \brief Writes SVG path data (the "d" attribute) with the shortest encoding per segment
+ *
+ * Coordinates are transformed by the layout and quantized to its decimal places *before* any
+ * differences are taken, so relative commands do not accumulate rounding errors. Each segment is
+ * written as absolute or relative line (L/l), horizontal (H/h) or vertical (V/v) command, whichever
+ * is shortest, omitting repeated command letters, unnecessary separators and leading zeros. Without
+ * fixed decimal places (see Precision::shortest()), only absolute commands are used.
+ */
+class PathDataWriter {
+public:
+    PathDataWriter(Sink & target, Layout const & l)
+        : sink(target), layout(l), decimals(l.decimals()), current(), start(), has_current(false), command(0),
+          previous(NoNumber) { }
+    void moveTo(Point const & p) { segment(p, true); }
+    void lineTo(Point const & p) { segment(p, false); }
+    // Closes the current subpath, its start point becomes the current point.
+    void closePath()
+    {
+        sink << 'z';
+        command = 'z';
+        previous = NoNumber;
+        current = start;
+    }
+    // Writes the points [first, last) of `points` as one subpath.
+    void subpath(PointBuffer const & points, size_t first, size_t last, bool closed)
+    {
+        if (first == last) {
+            return;
+        }
+        moveTo(points[first]);
+        for (size_t i = first + 1; i < last; ++i) {
+            lineTo(points[i]);
+        }
+        if (closed) {
+            closePath();
+        }
     }
+private:
+    // What precedes the next number: a command (or nothing), an integer or a fraction.
+    enum NumberState { NoNumber, Integer, Fraction };
+    struct Position {
+        double x, y;
+        long long qx, qy; // in units of 10^-decimals
+        bool quantized;
+    };
+    struct Number {
+        char text[32];
+        size_t length;
+    };
 
-    return combination_str;
-}
+    Sink & sink;
+    Layout const & layout;
+    int decimals;
+    Position current;
+    Position start;
+    bool has_current;
+    char command; // the one implicitly repeated by further coordinates
+    NumberState previous;
 
-class Circle : public SurfaceShape {
-public:
-    Circle(Point const & center_pos, double diameter, Fill const & fill_style,
-           Stroke const & stroke_style = Stroke())
-        : SurfaceShape(fill_style, stroke_style), center(center_pos), radius(diameter / 2)
+    // Formats a number, omitting the leading zero of fractions ("0.5" -> ".5").
+    static void format(Number & n, long long units, int places)
     {
-        if (!valid_num(center.x) || !valid_num(center.y) || !valid_num(diameter)) {
-            std::cerr << "Infs or NaNs provided to svg::Circle()." << std::endl;
+        n.length = internal::formatScaled(units, places, n.text);
+        strip(n);
+    }
+    static void format(Number & n, double value, int places)
+    {
+        n.length = internal::formatCoordinate(value, places, n.text);
+        strip(n);
+    }
+    static void strip(Number & n)
+    {
+        const size_t zero = n.text[0] == '-' ? 1 : 0;
+        if (n.length > zero + 1 && n.text[zero] == '0' && n.text[zero + 1] == '.') {
+            std::memmove(n.text + zero, n.text + zero + 1, n.length - zero - 1);
+            n.length--;
         }
     }
-    std::string toString(Layout const & l) const override
+    static NumberState stateAfter(Number const & n)
     {
-        std::stringstream ss;
-        ss << elemStart("circle") << serializeId()
-           << attribute("cx", translateX(center.x, l))
-           << attribute("cy", translateY(center.y, l))
-           << attribute("r", translateScale(radius, l))
-           << SurfaceShape::toString(l) << emptyElemEnd();
-        return ss.str();
+        for (size_t i = 0; i < n.length; ++i) {
+            if (n.text[i] == '.' || n.text[i] == 'e') {
+                return Fraction;
+            }
+        }
+        return Integer;
     }
-    void offset(Point const & offset) override
+    // Whether a separator is required before `next`.
+    static bool separate(NumberState before, Number const & next)
     {
-        if (!valid_num(offset.x) || !valid_num(offset.y)) {
-            std::cerr << "Infs or NaNs provided to svg::Circle::offset()." << std::endl;
+        return before != NoNumber && next.text[0] != '-' && !(next.text[0] == '.' && before == Fraction);
+    }
+    // Encoded length of `cmd` with its numbers (`second` may be null) in the current state.
+    size_t length(char cmd, bool force_command, Number const & first, Number const *second) const
+    {
+        const bool letter = force_command || cmd != command;
+        size_t n = (letter ? 1 : 0) + (!letter && separate(previous, first) ? 1 : 0) + first.length;
+        if (second) {
+            n += (separate(stateAfter(first), *second) ? 1 : 0) + second->length;
         }
-        center.x += offset.x;
-        center.y += offset.y;
+        return n;
     }
-    std::unique_ptr<Shape> clone() const override
+    void write(char cmd, bool force_command, Number const & first, Number const *second)
     {
-        return svg::make_unique<Circle>(*this);
+        if (force_command || cmd != command) {
+            sink << cmd;
+        } else if (separate(previous, first)) {
+            sink << ' ';
+        }
+        sink.write(first.text, first.length);
+        previous = stateAfter(first);
+        if (second) {
+            if (separate(previous, *second)) {
+                sink << ' ';
+            }
+            sink.write(second->text, second->length);
+            previous = stateAfter(*second);
+        }
+        // Coordinates following a moveto are implicit linetos:
+        command = cmd == 'M' ? 'L' : (cmd == 'm' ? 'l' : cmd);
+    }
+    void segment(Point const & p, bool move)
+    {
+        Position next;
+        next.x = translateX(p.x, layout);
+        next.y = translateY(p.y, layout);
+        next.quantized = decimals >= 0 && internal::quantize(next.x, decimals, next.qx)
+            && internal::quantize(next.y, decimals, next.qy);
+        Number abs_x, abs_y, rel_x, rel_y;
+        if (next.quantized) {
+            format(abs_x, next.qx, decimals);
+            format(abs_y, next.qy, decimals);
+        } else {
+            format(abs_x, next.x, decimals);
+            format(abs_y, next.y, decimals);
+        }
+        const bool relative = has_current && current.quantized && next.quantized;
+        if (relative) {
+            format(rel_x, next.qx - current.qx, decimals);
+            format(rel_y, next.qy - current.qy, decimals);
+        }
+
+        // Candidates: absolute and relative, for lines also horizontal and vertical ones.
+        char best = move ? 'M' : 'L';
+        size_t best_length = length(best, move, abs_x, &abs_y);
+        auto consider = [&](char cmd, Number const & first, Number const *second) {
+            const size_t n = length(cmd, move, first, second);
+            if (n < best_length) {
+                best = cmd;
+                best_length = n;
+            }
+        };
+        if (relative) {
+            consider(move ? 'm' : 'l', rel_x, &rel_y);
+        }
+        if (!move && has_current) {
+            const bool same_y = relative ? next.qy == current.qy : next.y == current.y;
+            const bool same_x = relative ? next.qx == current.qx : next.x == current.x;
+            if (same_y) {
+                consider('H', abs_x, nullptr);
+                if (relative) {
+                    consider('h', rel_x, nullptr);
+                }
+            }
+            if (same_x) {
+                consider('V', abs_y, nullptr);
+                if (relative) {
+                    consider('v', rel_y, nullptr);
+                }
+            }
+        }
+        switch (best) {
+        case 'm': case 'l': write(best, move, rel_x, &rel_y); break;
+        case 'H': write(best, move, abs_x, nullptr); break;
+        case 'h': write(best, move, rel_x, nullptr); break;
+        case 'V': write(best, move, abs_y, nullptr); break;
+        case 'v': write(best, move, rel_y, nullptr); break;
+        default: write(best, move, abs_x, &abs_y); break;
+        }
+        current = next;
+        has_current = true;
+        if (move) {
+            start = next;
+        }
     }
-private:
-    Point center;
-    double radius;
 };
 
-class Elipse : public SurfaceShape {
+namespace internal {
+    // Validates the points from index `first` on and reports Infs or NaNs with a single diagnostic,
+    // `where` names the calling function.
+    inline void checkPoints(PointBuffer const & points, const char *where, size_t first = 0)
+    {
+        const size_t invalid = points.countInvalid(first, points.size());
+        if (invalid != 0) {
+            std::cerr << "Infs or NaNs provided to " << where << " (" << invalid << " of "
+                      << points.size() - first << " points)." << std::endl;
+        }
+    }
+}
+
+/**
+ * Objects with an SVG representation. Derived classes override writeTo() (or, like in versions before
+ * the introduction of sinks, toString()), the default implementation of either one calls the other.
+ * \note Classes written for toString() keep working, but writeTo() avoids the temporary strings.
+ */
+class Serializeable {
 public:
-    Elipse(Point const & center_pos, double width, double height,
-        Fill const & fill_style = Fill(), Stroke const & stroke_style = Stroke())
-        : SurfaceShape(fill_style, stroke_style), center(center_pos), radius_width(width / 2.0),
-          radius_height(height / 2.0)
+    Serializeable() { }
+    virtual ~Serializeable() { }
+    // Appends the serialized representation to `sink`.
+    virtual void writeTo(Sink & sink, Layout const & l) const
     {
-        if (!valid_num(center.x) || !valid_num(center.y) || !valid_num(width) || !valid_num(height)) {
-            std::cerr << "Infs or NaNs provided to svg::Elipse()." << std::endl;
+        if (probe() == this) { // see writesItself()
+            probe() = nullptr;
+            return;
         }
+        sink << toString(l);
     }
-    std::string toString(Layout const & l) const override
+    virtual std::string toString(Layout const & l) const
     {
-        std::stringstream ss;
-        ss << elemStart("ellipse")<< serializeId()
-           << attribute("cx", translateX(center.x, l))
-           << attribute("cy", translateY(center.y, l))
-           << attribute("rx", translateScale(radius_width, l))
-           << attribute("ry", translateScale(radius_height, l))
-           << SurfaceShape::toString(l) << emptyElemEnd();
-        return ss.str();
+        StringSink sink;
+        writeTo(sink, l);
+        return sink.release();
     }
-    void offset(Point const & offset) override
+protected:
+    /**
+     * Writes the whole object into `result` via writeTo(), \c false if writeTo() is not overridden.
+     * Base classes use this to keep the toString() of earlier versions, which only returned their
+     * attributes to the toString() of derived classes.
+     */
+    bool writesItself(std::string & result, Layout const & l) const
     {
-        if (!valid_num(offset.x) || !valid_num(offset.y)) {
-            std::cerr << "Infs or NaNs provided to svg::Elipse::offset()." << std::endl;
+        const Serializeable *outer = probe(); // toString() of shapes may call that of others
+        probe() = this;
+        StringSink sink;
+        writeTo(sink, l);
+        const bool overridden = probe() == this;
+        probe() = outer;
+        result = sink.release();
+        return overridden;
+    }
+private:
+    static const Serializeable *& probe()
+    {
+        static thread_local const Serializeable *object = nullptr;
+        return object;
+    }
+};
+
+class Identifiable {
+public:
+  Identifiable(const std::string &identifier = {}) : id(identifier) { }
+  Identifiable(const Identifiable &) = default;
+  Identifiable(Identifiable &&) = default;
+  Identifiable& operator=(const Identifiable &) = default;
+  Identifiable& operator=(Identifiable &&) = default;
+  virtual ~Identifiable() { }
+  const std::string& getId() const { return id; }
+  void setId(const std::string &new_id = {})
+  {
+    id = new_id;
+    idChanged();
+  }
+  static std::string random(size_t len = 8)
+  {
+      std::string tmp_s;
+      static const char alphanum[] = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz";
+
+      static bool init_once = false;
+      if (!init_once) { // one-shot initialization upon first entering
+        std::srand(unsigned(time(nullptr)));
+        init_once = true;
+      }
+      tmp_s.reserve(len);
+      for (size_t i = 0; i < len; ++i) {
+          tmp_s += alphanum[unsigned(rand()) % (sizeof(alphanum) - 1)];
+      }
+      return tmp_s;
+  }
+protected:
+  std::string id;
+  // Called after the ID has been changed.
+  virtual void idChanged() { }
+  std::string serializeId() const
+  {
+    if (id.empty()) {
+      return {};
+    } else {
+      return attribute("id", id);
+    }
+  }
+  void writeId(Sink & sink) const
+  {
+    if (!id.empty()) {
+      attribute(sink, "id", id);
+    }
+  }
+};
+
+namespace internal {
+    // Appends the object representation of `value` to `key`.
+    template <typename T>
+    void appendKey(std::string & key, T const & value)
+    {
+        key.append(reinterpret_cast<const char *>(&value), sizeof(value));
+    }
+
+    /**
+     * Serialized bytes of the distinct styles (Fill, Stroke, Font) written during one document write,
+     * keyed by their values. The shapes themselves only keep their style values, the cache is dropped
+     * after the write. Styles written with another layout or output mode are formatted as usual.
+     * \note `l` must outlive the cache.
+     */
+    class StyleCache {
+    public:
+        StyleCache(Layout const & l, bool compact_output, bool css_output)
+            : layout(l), compact(compact_output), css(css_output) { }
+        template <typename Style>
+        void write(Style const & style, Sink & sink, Layout const & l)
+        {
+            if (sink.isCompact() != compact || sink.isCss() != css || (&l != &layout && l != layout)) {
+                style.writeUncached(sink, l);
+                return;
+            }
+            key.clear();
+            style.appendKey(key);
+            auto found = entries.find(key);
+            if (found == entries.end()) {
+                if (entries.size() >= MAX_ENTRIES) { // mostly distinct styles do not benefit
+                    style.writeUncached(sink, l);
+                    return;
+                }
+                StringSink fragment;
+                fragment.setCompact(compact);
+                fragment.setCss(css);
+                style.writeUncached(fragment, l);
+                found = entries.emplace(key, fragment.release()).first;
+            }
+            sink << found->second;
+        }
+    private:
+        static const size_t MAX_ENTRIES = 4096;
+        Layout const & layout;
+        bool compact;
+        bool css;
+        std::string key; // reused to avoid allocations
+        std::unordered_map<std::string, std::string> entries;
+    };
+
+    // Writes `style` to `sink`, via the sink's style cache if it has one.
+    template <typename Style>
+    void writeStyle(Style const & style, Sink & sink, Layout const & l)
+    {
+        if (sink.styleCache()) {
+            sink.styleCache()->write(style, sink, l);
+        } else {
+            style.writeUncached(sink, l);
+        }
+    }
+}
+
+class Color : public Serializeable {
+public:
+    enum Defaults { Transparent = -1, Aqua, Black, Gray, Blue, Brown, Cyan, Fuchsia,
+        Green, Lime, Magenta, Orange, Purple, Red, Silver, White, Yellow, Random };
+
+    Color(unsigned char r, unsigned char g, unsigned char b) : transparent(false) { assign(r, g, b); }
+    Color(Defaults color)
+        : transparent(false)
+    {
+        switch (color) {
+        case Aqua:    assign(  0, 255, 255); break;
+        case Black:   assign(  0,   0,   0); break;
+        case Gray:    assign(127, 127, 127); break;
+        case Blue:    assign(  0,   0, 255); break;
+        case Brown:   assign(165,  42,  42); break;
+        case Cyan:    assign(  0, 255, 255); break;
+        case Fuchsia: assign(255,   0, 255); break;
+        case Green:   assign(  0, 128,   0); break;
+        case Lime:    assign(  0, 255,   0); break;
+        case Magenta: assign(255,   0, 255); break;
+        case Orange:  assign(255, 165,   0); break;
+        case Purple:  assign(128,   0, 128); break;
+        case Red:     assign(255,   0,   0); break;
+        case Silver:  assign(192, 192, 192); break;
+        case White:   assign(255, 255, 255); break;
+        case Yellow:  assign(255, 255,   0); break;
+        case Random:
+          static bool srand_init = false;
+          if (!srand_init) {
+              srand(static_cast<unsigned int>(time(nullptr)));
+              srand_init = true;
+          }
+          assign(rand() % 256, rand() % 256, rand() % 256);
+          break;
+        case Transparent: // fall through...
+        default:
+            transparent = true;
+            std::memcpy(text, "none", 4);
+            length = 4;
+            break;
+        }
+    }
+    virtual ~Color() { }
+    bool isTransparent() const { return transparent; }
+    void writeTo(Sink & sink, Layout const &) const override { sink.write(text, length); }
+    // Appends the serialized color to `key` (see internal::StyleCache).
+    void appendKey(std::string & key) const
+    {
+        key += static_cast<char>(length);
+        key.append(text, length);
+    }
+private:
+    bool transparent;
+    unsigned char length;
+    char text[16]; // serialized once on construction, at most "rgb(255,255,255)"
+
+    void assign(int r, int g, int b)
+    {
+        char *p = text;
+        std::memcpy(p, "rgb(", 4);
+        p += 4;
+        p += internal::formatInteger(r, p);
+        *p++ = ',';
+        p += internal::formatInteger(g, p);
+        *p++ = ',';
+        p += internal::formatInteger(b, p);
+        *p++ = ')';
+        length = static_cast<unsigned char>(p - text);
+    }
+};
+
+class Fill : public Serializeable {
+public:
+    Fill(Color::Defaults fill_color, double opacity_level = 1.0)
+        : color(fill_color), opacity(opacity_level)
+    {
+        if (opacity_level < 0 || opacity_level > 1) {
+            std::cerr << "Fill::Fill(): opacity_level=" << opacity_level << " is out of range [0,1]." << std::endl;
+        }
+    }
+    Fill(Color fill_color = Color::Transparent)
+        : color(fill_color), opacity(1.0) { }
+    void writeTo(Sink & sink, Layout const & l) const override
+    {
+        internal::writeStyle(*this, sink, l);
+    }
+private:
+    Color color;
+    double opacity; // in [0, 1], 1 = fully visible, 0 = fully transparent
+
+    friend class internal::StyleCache;
+    template <typename Style>
+    friend void internal::writeStyle(Style const &, Sink &, Layout const &);
+    void appendKey(std::string & key) const
+    {
+        key += 'f';
+        color.appendKey(key);
+        internal::appendKey(key, opacity);
+    }
+    void writeUncached(Sink & sink, Layout const & l) const
+    {
+        attrStart(sink, "fill");
+        color.writeTo(sink, l);
+        attrEnd(sink);
+        if (opacity < 1.0) {
+            attribute(sink, "fill-opacity", opacity);
+        }
+    }
+};
+
+class Stroke : public Serializeable {
+public:
+    Stroke(double w = -1, Color stroke_color = Color::Transparent, bool nonScalingStroke = false,
+           double stroke_miterlimit = -1, std::vector<unsigned> stroke_dasharray = {},
+           unsigned int stroke_dashoffset = 0, double stroke_opacity = 1.0)
+        : width(w), color(stroke_color), nonScaling(nonScalingStroke),
+          miterlimit(stroke_miterlimit), dasharray(stroke_dasharray),
+          dashoffset(stroke_dashoffset), opacity(stroke_opacity)
+    {
+        if (!valid_num(width) || !valid_num(stroke_miterlimit) ||
+            !valid_num(stroke_opacity)) {
+            std::cerr << "Infs or NaNs provided to svg::Stroke()." << std::endl;
+        }
+        if (stroke_opacity < 0 || stroke_opacity > 1) {
+            std::cerr << "Stroke::Stroke(): stroke_opacity=" << stroke_opacity << " is out of range [0,1]." << std::endl;
+        }
+    }
+    void writeTo(Sink & sink, Layout const & l) const override
+    {
+        // If stroke width is invalid.
+        if (width < 0) {
+            return;
+        }
+        internal::writeStyle(*this, sink, l);
+    }
+private:
+    double width;
+    Color color;
+    bool nonScaling;
+    double miterlimit;
+    std::vector<unsigned> dasharray;
+    unsigned dashoffset;
+    double opacity; // in [0, 1], 1 = fully visible, 0 = fully transparent
+
+    friend class internal::StyleCache;
+    template <typename Style>
+    friend void internal::writeStyle(Style const &, Sink &, Layout const &);
+    void appendKey(std::string & key) const
+    {
+        key += 's';
+        internal::appendKey(key, width);
+        color.appendKey(key);
+        internal::appendKey(key, nonScaling);
+        internal::appendKey(key, miterlimit);
+        internal::appendKey(key, dashoffset);
+        internal::appendKey(key, opacity);
+        internal::appendKey(key, dasharray.size());
+        key.append(reinterpret_cast<const char *>(dasharray.data()), dasharray.size() * sizeof(unsigned));
+    }
+    void writeUncached(Sink & sink, Layout const & l) const
+    {
+        // Compact output omits the defaults stroke-width="1", stroke="none" and stroke-dashoffset="0":
+        const bool compact = sink.isCompact();
+        if (!compact || translateScale(width, l) != 1) {
+            attribute(sink, "stroke-width", coordScale(width, l));
+        }
+        if (!compact || !color.isTransparent()) {
+            attrStart(sink, "stroke");
+            color.writeTo(sink, l);
+            attrEnd(sink);
+        }
+        if (miterlimit >= 0) {
+            attribute(sink, "stroke-miterlimit", coordScale(miterlimit, l));
+        }
+        if (!compact || dashoffset != 0) {
+            attribute(sink, "stroke-dashoffset", coordScale(dashoffset, l));
+        }
+        if (!dasharray.empty()) {
+            attrStart(sink, "stroke-dasharray");
+            for (size_t i = 0; i < dasharray.size(); ++i) {
+                sink << dasharray[i];
+                if (i + 1 < dasharray.size()) {
+                    sink << ',';
+                }
+            }
+            attrEnd(sink);
+        }
+        if (opacity < 1.0) {
+            attribute(sink, "stroke-opacity", opacity);
+        }
+        if (nonScaling) {
+           attribute(sink, "vector-effect", "non-scaling-stroke");
+        }
+    }
+};
+
+class Font : public Serializeable {
+public:
+    Font(double font_size = 12, std::string const & font_family = "Verdana")
+        : size(font_size), family(font_family) { }
+    void writeTo(Sink & sink, Layout const & l) const override
+    {
+        internal::writeStyle(*this, sink, l);
+    }
+    double getSize() const { return size; }
+    void setSize(double s) { size = s; }
+    const std::string &getFamily() const { return family; }
+    void setFamily(const std::string &f) { family = f; }
+private:
+    double size;
+    std::string family;
+
+    friend class internal::StyleCache;
+    template <typename Style>
+    friend void internal::writeStyle(Style const &, Sink &, Layout const &);
+    void appendKey(std::string & key) const
+    {
+        key += 't';
+        internal::appendKey(key, size);
+        key += family;
+    }
+    void writeUncached(Sink & sink, Layout const & l) const
+    {
+        attribute(sink, "font-size", coordScale(size, l), sink.isCss() ? "px" : ""); // CSS requires a unit
+        attribute(sink, "font-family", family);
+    }
+};
+
+namespace internal {
+    // Returns a new, unique revision number (see Marker::getRevision()).
+    inline std::uint64_t nextRevision()
+    {
+        static std::atomic<std::uint64_t> counter(0);
+        return ++counter;
+    }
+
+    // Revisions of the markers (start, mid, end) a shape refers to, 0 for none.
+    struct MarkerRevisions {
+        MarkerRevisions() : start(0), mid(0), end(0) { }
+        bool operator==(MarkerRevisions const & that) const
+        {
+            return start == that.start && mid == that.mid && end == that.end;
+        }
+        std::uint64_t start;
+        std::uint64_t mid;
+        std::uint64_t end;
+    };
+
+    // Serialized bytes of a shape and the layout they have been created with.
+    struct SerializedShape {
+        SerializedShape(Layout const & l, Sink const & sink, MarkerRevisions const & m, std::string b)
+            : layout(l), compact(sink.isCompact()), style_class(sink.styleClass() ? sink.styleClass() : ""),
+              markers(m), bytes(std::move(b)) { }
+        // Whether these bytes are valid for writing to `sink` with layout `l` and markers `m`.
+        bool matches(Layout const & l, Sink const & sink, MarkerRevisions const & m) const
+        {
+            return layout == l && compact == sink.isCompact() && markers == m
+                && style_class == (sink.styleClass() ? sink.styleClass() : "");
+        }
+        Layout layout;
+        bool compact;
+        std::string style_class;
+        MarkerRevisions markers;
+        std::string bytes;
+    };
+}
+
+// All SVG entities (shapes) than have a stroke (that is, Line, Polyline, and all listed for "SurfaceShape")
+class Shape : public Serializeable, public Identifiable {
+public:
+    // Concrete type of a shape, Custom for types defined outside of this library.
+    enum class Kind : unsigned char { Custom, Circle, Elipse, Rectangle, Line, Polygon, Path, Polyline, Text, LineChart };
+    // Properties of a kind of shape, see capabilities().
+    enum Capability : unsigned char {
+        HasFill = 1,     // derived from SurfaceShape
+        HasMarkers = 2,  // derived from Markerable
+        HasPoints = 4,   // stores a PointBuffer
+        HasFont = 8,
+        Composite = 16   // consists of other shapes
+    };
+
+    Shape(Stroke const & stroke_style = Stroke(), int z_order = 0, const std::string& shape_id = {})
+        : Identifiable(shape_id), z(z_order), shape_kind(Kind::Custom), shape_capabilities(0), stroke(stroke_style) { }
+    Shape(const Shape &) = default;
+    Shape(Shape &&) = default;
+    Shape& operator=(const Shape &) = default;
+    Shape& operator=(Shape &&) = default;
+    virtual ~Shape() { }
+    // Allows branching on the type of a shape without virtual calls or dynamic_cast.
+    Kind kind() const { return shape_kind; }
+    // Bitmask of Capability flags, 0 for Kind::Custom.
+    unsigned capabilities() const { return shape_capabilities; }
+    bool has(Capability c) const { return (shape_capabilities & c) != 0; }
+    /**
+     * \brief Returns the whole element of shapes overriding writeTo()
+     *
+     * Otherwise, only the attributes common to all shapes (stroke, style, visibility) are returned,
+     * as custom shapes written for earlier versions expect from `Shape::toString(l)`. Such shapes
+     * should migrate to overriding writeTo() and calling writeAttributes().
+     */
+    std::string toString(Layout const & l) const override
+    {
+        std::string result;
+        if (writesItself(result, l)) {
+            return result;
+        }
+        StringSink sink;
+        writeAttributes(sink, l);
+        return sink.release();
+    }
+    virtual void offset(Point const & offset) = 0;
+    virtual std::unique_ptr<Shape> clone() const = 0;
+    // Like clone() but moves (instead of copies) all data into the new object, leaving *this empty.
+    virtual std::unique_ptr<Shape> moveClone() { return clone(); }
+    Stroke getStroke() const { return stroke; }
+    const std::string& getStyle() const { return style; }
+    void setStroke(Stroke s)
+    {
+        stroke = s;
+        invalidate();
+    }
+    void setStyle(const std::string &new_style)
+    {
+        style = new_style;
+        invalidate();
+    }
+    bool isVisible() const { return visible; }
+    void hide()
+    {
+        visible = false;
+        invalidate();
+    }
+    void show()
+    {
+        visible = true;
+        invalidate();
+    }
+    /**
+     * \brief Like writeTo() but reuses the bytes of the previous call if neither the shape, the
+     *        layout nor the output mode (see Sink::isCompact() and Sink::styleClass()) have changed
+     *        since then
+     * \note The bytes are kept until the shape is modified, which roughly doubles its memory use.
+     */
+    void writeCached(Sink & sink, Layout const & l) const
+    {
+        const internal::MarkerRevisions markers = markerRevisions();
+        if (!serialized || !serialized->matches(l, sink, markers)) {
+            StringSink fragment;
+            fragment.setCompact(sink.isCompact());
+            fragment.setStyleClass(sink.styleClass());
+            fragment.setStyleCache(sink.styleCache());
+            writeTo(fragment, l);
+            // Never modified in place, copies of this shape may share it:
+            serialized = std::make_shared<const internal::SerializedShape>(l, fragment, markers, fragment.release());
+        }
+        sink << serialized->bytes;
+    }
+    // Discards the bytes cached by writeCached(), called by all modifiers.
+    void invalidate() { serialized.reset(); }
+    /**
+     * \brief Writes the style attributes that may be shared with other shapes via a CSS class
+     * \note Whenever Sink::styleClass() is set, writeTo() writes that class instead of them.
+     */
+    virtual void writeStyleProperties(Sink & sink, Layout const & l) const { stroke.writeTo(sink, l); }
+    // \c false for shapes consisting of others (which are styled individually).
+    virtual bool hasStyleProperties() const { return !has(Composite); }
+    /**
+     * z order of SVG elements in the document. Default is zero which equals the order of insertion, that is,
+     * an element A that is inserted after an element B overlays it because A is drawn after (and possibly over) B.
+     * If all elements are zero, the default library behavior is applied (according to the SVG standard) and
+     * elements are not reordered before they are written to the SVG file.
+     * Elements (aka Shape's) with a smaller (and also possibly a negative) `z` are added/drawn before others with a larger z.
+     * That means, if you want an element A to be above/over an element B, set something like A.z > B.z. Alternatively, set
+     * A.z = B.z (or simply don't change it at all but then you have to ensure to add B *first*, then A.
+     */
+    int z;
+protected:
+    Kind shape_kind;
+    unsigned char shape_capabilities;
+    Stroke stroke;
+    std::string style;
+    bool visible = true;
+    mutable std::shared_ptr<const internal::SerializedShape> serialized;
+
+    // Used by the shapes of this library to set their kind and capabilities.
+    Shape(Kind k, unsigned capability_flags, Stroke const & stroke_style = Stroke())
+        : z(0), shape_kind(k), shape_capabilities(static_cast<unsigned char>(capability_flags)),
+          stroke(stroke_style) { }
+
+    void idChanged() override { invalidate(); }
+    // Revisions of the referenced markers, whose IDs are part of the output, see writeCached().
+    virtual internal::MarkerRevisions markerRevisions() const { return internal::MarkerRevisions(); }
+
+    // Writes the attributes common to all shapes (stroke or CSS class, style, visibility).
+    void writeAttributes(Sink & sink, Layout const & l) const
+    {
+        if (sink.styleClass()) {
+            attribute(sink, "class", sink.styleClass());
+        } else {
+            stroke.writeTo(sink, l);
+        }
+        if (!style.empty()) {
+            attribute(sink, "style", style);
+        }
+        if (!visible) {
+            attribute(sink, "visibility", "hidden");
+        }
+    }
+};
+
+// All SVG entities (shapes) that can be filled (that is, Circle, Ellipse, Rectangle, Polygon, Path, and Text)
+class SurfaceShape : public Shape {
+public:
+    SurfaceShape(Fill const & fill_style = Fill(), Stroke const & stroke_style = Stroke(), int z_order = 0, const std::string& shape_id = {})
+        : Shape(stroke_style, z_order, shape_id), fill(fill_style) { }
+    // Like Shape::toString(), the attributes also include the fill.
+    std::string toString(Layout const & l) const override
+    {
+        std::string result;
+        if (writesItself(result, l)) {
+            return result;
+        }
+        StringSink sink;
+        writeAttributes(sink, l);
+        return sink.release();
+    }
+    void setFill(Fill f)
+    {
+        fill = f;
+        invalidate();
+    }
+    Fill getFill() const { return fill; }
+protected:
+    Fill fill;
+    SurfaceShape(Kind k, unsigned capability_flags, Fill const & fill_style, Stroke const & stroke_style)
+        : Shape(k, capability_flags | HasFill, stroke_style), fill(fill_style) { }
+    SurfaceShape(const SurfaceShape &) = default;
+    SurfaceShape(SurfaceShape &&) = default;
+    SurfaceShape& operator=(const SurfaceShape &) = default;
+    SurfaceShape& operator=(SurfaceShape &&) = default;
+    virtual ~SurfaceShape() { }
+
+    void writeAttributes(Sink & sink, Layout const & l) const
+    {
+        Shape::writeAttributes(sink, l);
+        if (!sink.styleClass()) {
+            fill.writeTo(sink, l);
+        }
+    }
+    void writeStyleProperties(Sink & sink, Layout const & l) const override
+    {
+        Shape::writeStyleProperties(sink, l);
+        fill.writeTo(sink, l);
+    }
+};
+
+class Marker : public Serializeable, public Identifiable {
+public:
+    // Creates an empty marker (no visual effect).
+    Marker() : orient("auto") { }
+    Marker(const std::string &markerId, double markerWidth, double markerHeight, double refX, double refY,
+           const Shape &shape, const std::string &orientation = "auto")
+        : Identifiable(markerId), marker_width(markerWidth), marker_height(markerHeight), ref_x(refX),
+          ref_y(refY), orient(orientation)
+    {
+        *this << shape;
+    }
+    Marker(const Marker &that) : Identifiable(that.id)
+    {
+        shapes.reserve(that.shapes.size());
+        for (size_t i = 0; i < that.shapes.size(); ++i) {
+            shapes.push_back(that.shapes[i]->clone());
+        }
+        id = that.id;
+        marker_width = that.marker_width;
+        marker_height = that.marker_height;
+        ref_x = that.ref_x;
+        ref_y = that.ref_y;
+        orient = that.orient;
+    }
+    Marker(Marker &&that)
+    {
+        shapes.reserve(that.shapes.size());
+        for (size_t i = 0; i < that.shapes.size(); ++i) {
+            shapes.push_back(std::move(that.shapes[i]));
+        }
+        that.shapes.clear();
+
+        id = that.id;
+        that.id.clear();
+        marker_width = that.marker_width;
+        marker_height = that.marker_height;
+        ref_x = that.ref_x;
+        ref_y = that.ref_y;
+        orient = that.orient;
+    }
+    Marker& operator=(Marker &that)
+    {
+        if (this != &that) {
+            shapes.reserve(that.shapes.size());
+            for (size_t i = 0; i < that.shapes.size(); ++i) {
+                shapes.push_back(that.shapes[i]->clone());
+            }
+            id = that.id;
+            marker_width = that.marker_width;
+            marker_height = that.marker_height;
+            ref_x = that.ref_x;
+            ref_y = that.ref_y;
+            orient = that.orient;
+            revision = internal::nextRevision();
+        }
+        return *this;
+    }
+    Marker& operator=(Marker &&that)
+    {
+        if (this != &that) {
+            shapes.reserve(that.shapes.size());
+            for (size_t i = 0; i < that.shapes.size(); ++i) {
+                shapes.push_back(std::move(that.shapes[i]));
+            }
+            that.shapes.clear();
+
+            id = that.id;
+            that.id.clear();
+            marker_width = that.marker_width;
+            marker_height = that.marker_height;
+            ref_x = that.ref_x;
+            ref_y = that.ref_y;
+            orient = that.orient;
+            revision = internal::nextRevision();
+        }
+        return *this;
+    }
+    Marker& operator<<(const Shape &shape)
+    {
+        shapes.push_back(shape.clone());
+        return *this;
+    }
+    Marker& operator<<(Shape &&shape)
+    {
+        shapes.push_back(shape.moveClone());
+        return *this;
+    }
+    // Takes ownership of `shape` (without copying it).
+    Marker& add(std::unique_ptr<Shape> shape)
+    {
+        if (shape) {
+            shapes.push_back(std::move(shape));
+        }
+        return *this;
+    }
+    void writeTo(Sink & sink, Layout const &) const override
+    {
+        if (id.empty()) {
+            throw std::invalid_argument("svg::Marker::writeTo() requires a non-empty ID to refer to that marker.");
+        }
+
+        // Don't add any translation:
+        const Layout UNCHANGED(Dimensions(), Layout::TopLeft);
+
+        if (valid()) { // only if not empty / defined
+            whitespace(sink, "\t");
+            elemStart(sink, "marker");
+            writeId(sink);
+            attribute(sink, "markerWidth", marker_width);
+            attribute(sink, "markerHeight", marker_height);
+            attribute(sink, "refX", ref_x);
+            attribute(sink, "refY", ref_y);
+            attribute(sink, "orient", orient);
+            sink << '>';
+            whitespace(sink, "\n");
+            for (size_t i = 0; i < shapes.size(); ++i) {
+                whitespace(sink, "\t\t");
+                shapes[i]->writeTo(sink, UNCHANGED);
+                if (i + 1 < shapes.size()) {
+                    whitespace(sink, "\n");
+                }
+            }
+            whitespace(sink, "\t\t");
+            elemEnd(sink, "marker");
+        }
+    }
+    bool valid() const { return !id.empty(); }
+    std::unique_ptr<Shape>& operator[](size_t index) { return shapes[index]; }
+    size_t size() const { return shapes.size(); }
+    // Checks if \c *this is \a visually not equal to \c that. \c id is \a not considered.
+    // This is used in svg::Document to test for Marker ID collisions.
+    bool operator!=(const Marker &that) const
+    {
+        if (shapes.size() != that.shapes.size() || !equal(marker_width, that.marker_width) ||
+            !equal(ref_x, that.ref_x) || !equal(marker_height, that.marker_height) ||
+            !equal(ref_y, that.ref_y)) {
+            return true;
+        }
+        // Convert all shapes to strings, sort them to make the comparison independent of the
+        // order:
+        const Layout DUMMY;
+        std::vector<std::string> str_shapes[2];
+        str_shapes[0].resize(shapes.size());
+        str_shapes[1].resize(shapes.size());
+        for (size_t i = 0; i < shapes.size(); ++i) {
+            str_shapes[0][i] = shapes[i]->toString(DUMMY);
+            str_shapes[1][i] = that.shapes[i]->toString(DUMMY);
+        }
+        std::sort(str_shapes[0].begin(), str_shapes[0].end());
+        std::sort(str_shapes[1].begin(), str_shapes[1].end());
+        for (size_t i = 0; i < shapes.size(); ++i) {
+            if (str_shapes[0][i] != str_shapes[1][i]) {
+                return true;
+            }
+        }
+        return false;
+    }
+    // Hash of the visual appearance: markers not differing according to operator!=() usually have
+    // the same hash (unless their dimensions only differ within the tolerance of svg::equal()).
+    size_t hash() const
+    {
+        const Layout DUMMY;
+        const std::hash<double> hash_double;
+        size_t result = shapes.size();
+        for (double value: { marker_width, marker_height, ref_x, ref_y }) {
+            result = result * 31 + hash_double(value);
+        }
+        // Sum up the hashes of the shapes to make it independent of their order:
+        const std::hash<std::string> hash_string;
+        size_t shapes_hash = 0;
+        for (size_t i = 0; i < shapes.size(); ++i) {
+            shapes_hash += hash_string(shapes[i]->toString(DUMMY));
+        }
+        return result * 31 + shapes_hash;
+    }
+    void setOrientation(const std::string orientation = "auto")
+    {
+        if (orientation != "auto" && orientation != "auto-start-reverse") {
+            throw std::invalid_argument("Marker::setOrientation() only accepts the strings \"auto\" or \"auto-start-reverse\".");
+        }
+        orient = orientation;
+    }
+    void setOrientation(double angle) { orient = std::to_string(angle); }
+    // Changes whenever the ID changes, unique among all markers (caches of shapes referring to it use it).
+    std::uint64_t getRevision() const { return revision; }
+protected:
+    void idChanged() override { revision = internal::nextRevision(); }
+private:
+    std::vector<std::unique_ptr<Shape>> shapes;
+    double marker_width;
+    double marker_height;
+    double ref_x;
+    double ref_y;
+    std::string orient;
+    std::uint64_t revision = internal::nextRevision();
+};
+
+namespace internal {
+    auto compareMarker = [](const Marker *a, const Marker *b) { return a->getId() < b->getId(); };
+    typedef std::set<const Marker*, decltype(compareMarker)> MarkerSet;
+
+    /**
+     * \brief Markers referred to by the shapes of a document, by ID
+     *
+     * Shapes register their markers when they are added to the document (or when their markers are
+     * changed afterwards). The hash of every distinct marker is computed once upon its registration,
+     * so markers colliding with a different one of the same ID are detected in O(1).
+     * \note Markers must not be modified once a shape of the document refers to them.
+     */
+    class MarkerRegistry {
+    public:
+        // Registers one more use of `marker` (if valid). Warns if it collides with another marker.
+        void use(const Marker *marker)
+        {
+            if (!marker || !marker->valid()) {
+                return;
+            }
+            auto inserted = registrations.emplace(marker, Registration());
+            Registration & registration = inserted.first->second;
+            registration.uses++;
+            if (inserted.second) {
+                add(marker, marker->getId());
+                registration.id = marker->getId();
+            }
+        }
+        // Unregisters one use of `marker`, found by its address as its ID may have been changed since.
+        void release(const Marker *marker)
+        {
+            auto found = registrations.find(marker);
+            if (found == registrations.end() || --found->second.uses != 0) {
+                return;
+            }
+            remove(marker, found->second.id);
+            registrations.erase(found);
+        }
+        // Returns the markers in use, one (the first registered) per ID. Markers whose ID has been
+        // changed since their registration are registered under their new ID first.
+        MarkerSet used()
+        {
+            for (auto &registration : registrations) {
+                const Marker *marker = registration.first;
+                std::string & id = registration.second.id;
+                if (marker->getId() != id || (!id.empty() && !marker->valid())) {
+                    remove(marker, id);
+                    id.clear();
+                    if (marker->valid()) {
+                        add(marker, marker->getId());
+                        id = marker->getId();
+                    }
+                }
+            }
+            MarkerSet result(compareMarker);
+            for (const auto &m: markers) {
+                result.insert(m.second.users.front());
+            }
+            return result;
+        }
+        void clear()
+        {
+            markers.clear();
+            registrations.clear();
+        }
+    private:
+        struct Entry {
+            size_t hash;
+            // Distinct marker objects registered under this ID.
+            std::vector<const Marker*> users;
+        };
+        struct Registration {
+            Registration() : uses(0) { }
+            std::string id; // the ID `markers` refers to it by, empty if not valid at that time
+            size_t uses;
+        };
+        std::unordered_map<std::string, Entry> markers;
+        std::unordered_map<const Marker*, Registration> registrations;
+
+        void add(const Marker *marker, std::string const & id)
+        {
+            auto inserted = markers.emplace(id, Entry());
+            Entry & entry = inserted.first->second;
+            if (inserted.second) {
+                entry.hash = marker->hash();
+            }
+            // A different object, only compare in full if the hashes disagree:
+            if (!entry.users.empty() && marker->hash() != entry.hash && *marker != *entry.users.front()) {
+                std::cerr << "Marker collision detected for ID=" << id
+                          << ". Expect markers not to be rendered correctly." << std::endl;
+            }
+            entry.users.push_back(marker);
+        }
+        // Does not dereference `marker`, which may have been destroyed already.
+        void remove(const Marker *marker, std::string const & id)
+        {
+            auto found = markers.find(id);
+            if (found == markers.end()) {
+                return;
+            }
+            auto &users = found->second.users;
+            users.erase(std::remove(users.begin(), users.end(), marker), users.end());
+            if (users.empty()) {
+                markers.erase(found);
+            }
+        }
+    };
+}
+
+// Mixin for shapes that can refer to markers (that is, Line and Polyline).
+class Markerable {
+public:
+    Markerable() : marker_start(nullptr), marker_mid(nullptr), marker_end(nullptr), registry(nullptr) { }
+    // Copies are not part of any document (yet):
+    Markerable(const Markerable &that)
+        : marker_start(that.marker_start), marker_mid(that.marker_mid), marker_end(that.marker_end),
+          registry(nullptr) { }
+    Markerable& operator=(const Markerable &that)
+    {
+        setMarker(marker_start, that.marker_start);
+        setMarker(marker_mid, that.marker_mid);
+        setMarker(marker_end, that.marker_end);
+        return *this;
+    }
+    virtual ~Markerable() { }
+    void setStartMarker(const Marker *m)
+    {
+        setMarker(marker_start, m);
+        markersChanged();
+    }
+    void setMidMarker(const Marker *m)
+    {
+        setMarker(marker_mid, m);
+        markersChanged();
+    }
+    void setEndMarker(const Marker *m)
+    {
+        setMarker(marker_end, m);
+        markersChanged();
+    }
+    // Revisions of the referenced markers, which change whenever the references have to be rewritten.
+    internal::MarkerRevisions getMarkerRevisions() const
+    {
+        internal::MarkerRevisions result;
+        result.start = marker_start ? marker_start->getRevision() : 0;
+        result.mid = marker_mid ? marker_mid->getRevision() : 0;
+        result.end = marker_end ? marker_end->getRevision() : 0;
+        return result;
+    }
+    // Writes the marker references, e.g., marker-start="url(#id)".
+    void writeMarkerAttributes(Sink & sink) const
+    {
+        if (marker_start && marker_start->valid()) {
+            attrStart(sink, "marker-start");
+            sink << "url(#" << marker_start->getId() << ')';
+            attrEnd(sink);
+        }
+        if (marker_mid && marker_mid->valid()) {
+            attrStart(sink, "marker-mid");
+            sink << "url(#" << marker_mid->getId() << ')';
+            attrEnd(sink);
+        }
+        if (marker_end && marker_end->valid()) {
+            attrStart(sink, "marker-end");
+            sink << "url(#" << marker_end->getId() << ')';
+            attrEnd(sink);
+        }
+    }
+    internal::MarkerSet getUsedMarkers() const
+    {
+        internal::MarkerSet result(internal::compareMarker);
+        if (marker_start && marker_start->valid()) {
+            result.insert(marker_start);
+        }
+        if (marker_mid && marker_mid->valid()) {
+            result.insert(marker_mid);
+        }
+        if (marker_end && marker_end->valid()) {
+            result.insert(marker_end);
+        }
+        return result;
+    }
+
+protected:
+    // Called after any of the markers has been changed.
+    virtual void markersChanged() { }
+private:
+    friend class Document;
+
+    const Marker *marker_start;
+    const Marker *marker_mid;
+    const Marker *marker_end;
+    // Registry of the document owning this shape (if any), kept up to date with the markers above.
+    internal::MarkerRegistry *registry;
+
+    void setMarker(const Marker *& marker, const Marker *new_marker)
+    {
+        if (registry) {
+            registry->use(new_marker);
+            registry->release(marker);
+        }
+        marker = new_marker;
+    }
+    void attach(internal::MarkerRegistry *new_registry)
+    {
+        registry = new_registry;
+        registry->use(marker_start);
+        registry->use(marker_mid);
+        registry->use(marker_end);
+    }
+};
+
+template <typename T>
+inline std::string vectorToString(std::vector<T> collection, Layout const & layout)
+{
+    std::string combination_str;
+    for (unsigned i = 0; i < collection.size(); ++i) {
+        combination_str += collection[i].toString(layout);
+    }
+
+    return combination_str;
+}
+
+class Circle : public SurfaceShape {
+public:
+    Circle(Point const & center_pos, double diameter, Fill const & fill_style,
+           Stroke const & stroke_style = Stroke())
+        : SurfaceShape(Kind::Circle, 0, fill_style, stroke_style), center(center_pos), radius(diameter / 2)
+    {
+        if (!valid_num(center.x) || !valid_num(center.y) || !valid_num(diameter)) {
+            std::cerr << "Infs or NaNs provided to svg::Circle()." << std::endl;
+        }
+    }
+    void writeTo(Sink & sink, Layout const & l) const override
+    {
+        elemStart(sink, "circle");
+        writeId(sink);
+        attribute(sink, "cx", coordX(center.x, l));
+        attribute(sink, "cy", coordY(center.y, l));
+        attribute(sink, "r", coordScale(radius, l));
+        SurfaceShape::writeAttributes(sink, l);
+        emptyElemEnd(sink);
+    }
+    void offset(Point const & offset) override
+    {
+        invalidate();
+        if (!valid_num(offset.x) || !valid_num(offset.y)) {
+            std::cerr << "Infs or NaNs provided to svg::Circle::offset()." << std::endl;
+        }
+        center.x += offset.x;
+        center.y += offset.y;
+    }
+    std::unique_ptr<Shape> clone() const override
+    {
+        return svg::make_unique<Circle>(*this);
+    }
+    std::unique_ptr<Shape> moveClone() override
+    {
+        return svg::make_unique<Circle>(std::move(*this));
+    }
+private:
+    Point center;
+    double radius;
+};
+
+class Elipse : public SurfaceShape {
+public:
+    Elipse(Point const & center_pos, double width, double height,
+        Fill const & fill_style = Fill(), Stroke const & stroke_style = Stroke())
+        : SurfaceShape(Kind::Elipse, 0, fill_style, stroke_style), center(center_pos), radius_width(width / 2.0),
+          radius_height(height / 2.0)
+    {
+        if (!valid_num(center.x) || !valid_num(center.y) || !valid_num(width) || !valid_num(height)) {
+            std::cerr << "Infs or NaNs provided to svg::Elipse()." << std::endl;
+        }
+    }
+    void writeTo(Sink & sink, Layout const & l) const override
+    {
+        elemStart(sink, "ellipse");
+        writeId(sink);
+        attribute(sink, "cx", coordX(center.x, l));
+        attribute(sink, "cy", coordY(center.y, l));
+        attribute(sink, "rx", coordScale(radius_width, l));
+        attribute(sink, "ry", coordScale(radius_height, l));
+        SurfaceShape::writeAttributes(sink, l);
+        emptyElemEnd(sink);
+    }
+    void offset(Point const & offset) override
+    {
+        invalidate();
+        if (!valid_num(offset.x) || !valid_num(offset.y)) {
+            std::cerr << "Infs or NaNs provided to svg::Elipse::offset()." << std::endl;
         }
         center.x += offset.x;
         center.y += offset.y;
     }
-    std::unique_ptr<Shape> clone() const override
+    std::unique_ptr<Shape> clone() const override
+    {
+        return svg::make_unique<Elipse>(*this);
+    }
+    std::unique_ptr<Shape> moveClone() override
+    {
+        return svg::make_unique<Elipse>(std::move(*this));
+    }
+private:
+    Point center;
+    double radius_width;
+    double radius_height;
+};
+
+class Rectangle : public SurfaceShape {
+public:
+    /**
+     * Creates a rectangle (fillable shape).
+     * \param [in] edge Upper left corner of the rectangle
+     * \param [in] width Width of the rectangle
+     * \param [in] height Height of the rectangle
+     * \param [in] fill Fill style used to fill the rectangular area
+     * \param [in] stroke Stroke used to create the boundary contour
+     */
+    Rectangle(Point const & upper_left_corner, double w, double h, Fill const & fill_style = Fill(),
+              Stroke const & stroke_style = Stroke(), double rx_corner = 0.0, double ry_corner = 0.0)
+        : SurfaceShape(Kind::Rectangle, 0, fill_style, stroke_style), edge(upper_left_corner), width(w), height(h), rx(rx_corner),
+          ry(ry_corner)
+    {
+        if (!valid_num(edge.x) || !valid_num(edge.y) || !valid_num(width) || !valid_num(height) ||
+            !valid_num(rx) || !valid_num(ry)) {
+            std::cerr << "Infs or NaNs provided to svg::Rectangle()." << std::endl;
+        }
+    }
+    void writeTo(Sink & sink, Layout const & l) const override
+    {
+        elemStart(sink, "rect");
+        writeId(sink);
+        attribute(sink, "x", coordX(edge.x, l));
+        attribute(sink, "y", coordY(edge.y, l));
+        if (rx > 0.0 || ry > 0.0) {
+            attribute(sink, "rx", rx);
+            attribute(sink, "ry", ry);
+        }
+        attribute(sink, "width", coordScale(width, l));
+        attribute(sink, "height", coordScale(height, l));
+        SurfaceShape::writeAttributes(sink, l);
+        emptyElemEnd(sink);
+    }
+    void offset(Point const & offset) override
+    {
+        invalidate();
+        if (!valid_num(offset.x) || !valid_num(offset.y)) {
+            std::cerr << "Infs or NaNs provided to svg::Rectangle::offset()." << std::endl;
+        }
+        edge.x += offset.x;
+        edge.y += offset.y;
+    }
+    Rectangle centerAt(Point const & pos) const
+    {
+        if (!valid_num(pos.x) || !valid_num(pos.y)) {
+            std::cerr << "Infs or NaNs provided to svg::Rectangle::centerAt()." << std::endl;
+        }
+        return Rectangle(Point(pos.x - width / 2.0, pos.y - height / 2.0), width, height, fill, stroke);
+    }
+    std::unique_ptr<Shape> clone() const override
+    {
+        return svg::make_unique<Rectangle>(*this);
+    }
+    std::unique_ptr<Shape> moveClone() override
+    {
+        return svg::make_unique<Rectangle>(std::move(*this));
+    }
+private:
+    Point edge;
+    double width;
+    double height;
+    double rx; //<! Rounded corner radius in x direction
+    double ry; //<! Rounded corner radius in y direction
+};
+
+class Line : public Shape, public Markerable {
+public:
+    Line(Point const & start_pt, Point const & end_pt, Stroke const & stroke_style = Stroke())
+        : Shape(Kind::Line, HasMarkers, stroke_style), start_point(start_pt), end_point(end_pt)
+    {
+        if (!valid_num(start_point.x) || !valid_num(start_point.y) ||
+            !valid_num(end_point.x) || !valid_num(end_point.y)) {
+            std::cerr << "Infs or NaNs provided to svg::Line()." << std::endl;
+        }
+    }
+    void writeTo(Sink & sink, Layout const & l) const override
+    {
+        elemStart(sink, "line");
+        writeId(sink);
+        attribute(sink, "x1", coordX(start_point.x, l));
+        attribute(sink, "y1", coordY(start_point.y, l));
+        attribute(sink, "x2", coordX(end_point.x, l));
+        attribute(sink, "y2", coordY(end_point.y, l));
+        Shape::writeAttributes(sink, l);
+        writeMarkerAttributes(sink);
+        emptyElemEnd(sink);
+    }
+    void offset(Point const & offset) override
+    {
+        invalidate();
+        if (!valid_num(offset.x) || !valid_num(offset.y)) {
+            std::cerr << "Infs or NaNs provided to svg::Line::offset()." << std::endl;
+        }
+        start_point.x += offset.x;
+        start_point.y += offset.y;
+
+        end_point.x += offset.x;
+        end_point.y += offset.y;
+    }
+    std::unique_ptr<Shape> clone() const override
+    {
+        return svg::make_unique<Line>(*this);
+    }
+    std::unique_ptr<Shape> moveClone() override
+    {
+        return svg::make_unique<Line>(std::move(*this));
+    }
+protected:
+    void markersChanged() override { invalidate(); }
+    internal::MarkerRevisions markerRevisions() const override { return getMarkerRevisions(); }
+private:
+    Point start_point;
+    Point end_point;
+};
+
+class Polygon : public SurfaceShape {
+public:
+    Polygon(Fill const & fill_style = Fill(), Stroke const & stroke_style = Stroke())
+        : SurfaceShape(Kind::Polygon, HasPoints, fill_style, stroke_style) { }
+    Polygon(const std::vector<Point> &pts, Fill const & fill_style = Fill(), Stroke const & stroke_style = Stroke())
+        : SurfaceShape(Kind::Polygon, HasPoints, fill_style, stroke_style), points(pts)
+    {
+        internal::checkPoints(points, "svg::Polygon()");
+    }
+    // Stores the points column-wise (structure of arrays), see PointColumns.
+    Polygon(PointColumns pts, Fill const & fill_style = Fill(), Stroke const & stroke_style = Stroke())
+        : SurfaceShape(Kind::Polygon, HasPoints, fill_style, stroke_style), points(std::move(pts))
+    {
+        internal::checkPoints(points, "svg::Polygon()");
+    }
+    // References caller-owned points without copying them, see PointView.
+    Polygon(PointView const & pts, Fill const & fill_style = Fill(), Stroke const & stroke_style = Stroke())
+        : SurfaceShape(Kind::Polygon, HasPoints, fill_style, stroke_style), points(pts)
+    {
+        internal::checkPoints(points, "svg::Polygon()");
+    }
+    Polygon(Stroke const & stroke_style = Stroke()) : SurfaceShape(Kind::Polygon, HasPoints, Color::Transparent, stroke_style) { }
+    Polygon & operator<<(Point const & point)
+    {
+        if (!valid_num(point.x) || !valid_num(point.y)) {
+            std::cerr << "Infs or NaNs provided to svg::Polygon::operator<<()." << std::endl;
+        }
+        points.push_back(point);
+        invalidate();
+        return *this;
+    }
+    void reserve(size_t n) { points.reserve(n); }
+    // Appends `n` points given as separate x/y arrays.
+    Polygon & append(const double *xs, const double *ys, size_t n)
+    {
+        const size_t first = points.size();
+        points.append(xs, ys, n);
+        internal::checkPoints(points, "svg::Polygon::append()", first);
+        invalidate();
+        return *this;
+    }
+    // Appends the points [first, last).
+    template <typename InputIt>
+    Polygon & append(InputIt first, InputIt last)
+    {
+        const size_t offset = points.size();
+        points.append(first, last);
+        internal::checkPoints(points, "svg::Polygon::append()", offset);
+        invalidate();
+        return *this;
+    }
+    void writeTo(Sink & sink, Layout const & l) const override
+    {
+        elemStart(sink, "polygon");
+        writeId(sink);
+
+        attrStart(sink, "points");
+        points.writeTo(sink, l);
+        attrEnd(sink);
+
+        SurfaceShape::writeAttributes(sink, l);
+        emptyElemEnd(sink);
+    }
+    void offset(Point const & offset) override
+    {
+        invalidate();
+        if (!valid_num(offset.x) || !valid_num(offset.y)) {
+            std::cerr << "Infs or NaNs provided to svg::Polygon::offset()." << std::endl;
+        }
+        points.offset(offset);
+    }
+    std::unique_ptr<Shape> clone() const override
+    {
+        return svg::make_unique<Polygon>(*this);
+    }
+    std::unique_ptr<Shape> moveClone() override
+    {
+        return svg::make_unique<Polygon>(std::move(*this));
+    }
+    const PointBuffer & getPoints() const { return points; }
+private:
+    PointBuffer points;
+};
+
+class Path : public SurfaceShape {
+public:
+    Path(Fill const & fill_style = Fill(), Stroke const & stroke_style = Stroke())
+        : SurfaceShape(Kind::Path, HasPoints, fill_style, stroke_style)
+    { startNewSubPath(); }
+    Path(std::vector<Point> const & pts, Fill const & fill_style = Fill(), Stroke const & stroke_style = Stroke())
+        : SurfaceShape(Kind::Path, HasPoints, fill_style, stroke_style), points(pts)
+    {
+        internal::checkPoints(points, "svg::Path()");
+        subpath_starts.push_back(0);
+    }
+    // Stores the points column-wise (structure of arrays), see PointColumns.
+    Path(PointColumns pts, Fill const & fill_style = Fill(), Stroke const & stroke_style = Stroke())
+        : SurfaceShape(Kind::Path, HasPoints, fill_style, stroke_style), points(std::move(pts))
+    {
+        internal::checkPoints(points, "svg::Path()");
+        subpath_starts.push_back(0);
+    }
+    Path(Stroke const & stroke_style = Stroke()) : SurfaceShape(Kind::Path, HasPoints, Color::Transparent, stroke_style)
+    {  startNewSubPath(); }
+    Path & operator<<(Point const & point)
+    {
+        if (!valid_num(point.x) || !valid_num(point.y)) {
+            std::cerr << "Infs or NaNs provided to svg::Path::operator<<()." << std::endl;
+        }
+        points.push_back(point);
+        invalidate();
+        return *this;
+    }
+    void reserve(size_t n) { points.reserve(n); }
+    // Appends `n` points given as separate x/y arrays.
+    Path & append(const double *xs, const double *ys, size_t n)
+    {
+        const size_t first = points.size();
+        points.append(xs, ys, n);
+        internal::checkPoints(points, "svg::Path::append()", first);
+        invalidate();
+        return *this;
+    }
+    // Appends the points [first, last).
+    template <typename InputIt>
+    Path & append(InputIt first, InputIt last)
+    {
+        const size_t offset = points.size();
+        points.append(first, last);
+        internal::checkPoints(points, "svg::Path::append()", offset);
+        invalidate();
+        return *this;
+    }
+    void startNewSubPath()
+    {
+        if (subpath_starts.empty() || subpath_starts.back() < points.size()) {
+            subpath_starts.push_back(points.size());
+            invalidate();
+        }
+    }
+    void writeTo(Sink & sink, Layout const & l) const override
+    {
+        elemStart(sink, "path");
+        writeId(sink);
+
+        attrStart(sink, "d");
+        PathDataWriter path_data(sink, l);
+        for (size_t i = 0; i < subpath_starts.size(); ++i) {
+            const size_t first = subpath_starts[i];
+            const size_t last = i + 1 < subpath_starts.size() ? subpath_starts[i + 1] : points.size();
+            if (first == last) {
+                continue;
+            }
+
+            if (sink.isCompact()) {
+                path_data.subpath(points, first, last, true);
+            } else {
+                sink << 'M';
+                points.writeTo(sink, l, first, last);
+                sink << "z ";
+            }
+        }
+        attrEnd(sink);
+        attribute(sink, "fill-rule", "evenodd");
+
+        SurfaceShape::writeAttributes(sink, l);
+        emptyElemEnd(sink);
+    }
+    void offset(Point const & offset) override
+    {
+        invalidate();
+        if (!valid_num(offset.x) || !valid_num(offset.y)) {
+            std::cerr << "Infs or NaNs provided to svg::Path::offset()." << std::endl;
+        }
+        points.offset(offset);
+    }
+    std::unique_ptr<Shape> clone() const override
+    {
+        return svg::make_unique<Path>(*this);
+    }
+    std::unique_ptr<Shape> moveClone() override
+    {
+        return svg::make_unique<Path>(std::move(*this));
+    }
+private:
+    // All subpaths stored back to back, subpath i starts at points[subpath_starts[i]].
+    PointBuffer points;
+    std::vector<size_t> subpath_starts;
+};
+
+class Polyline : public Shape, public Markerable {
+public:
+    Polyline(Stroke const & stroke_style = Stroke()) : Shape(Kind::Polyline, HasMarkers | HasPoints, stroke_style) { }
+    Polyline(std::vector<Point> const & pts, Stroke const & stroke_style = Stroke())
+        : Shape(Kind::Polyline, HasMarkers | HasPoints, stroke_style), points(pts)
+    {
+        internal::checkPoints(points, "svg::Polyline()");
+    }
+    // Stores the points column-wise (structure of arrays), see PointColumns.
+    Polyline(PointColumns pts, Stroke const & stroke_style = Stroke())
+        : Shape(Kind::Polyline, HasMarkers | HasPoints, stroke_style), points(std::move(pts))
+    {
+        internal::checkPoints(points, "svg::Polyline()");
+    }
+    // References caller-owned points without copying them, see PointView.
+    Polyline(PointView const & pts, Stroke const & stroke_style = Stroke())
+        : Shape(Kind::Polyline, HasMarkers | HasPoints, stroke_style), points(pts)
+    {
+        internal::checkPoints(points, "svg::Polyline()");
+    }
+    Polyline & operator<<(Point const & point)
+    {
+        if (!valid_num(point.x) || !valid_num(point.y)) {
+            std::cerr << "Infs or NaNs provided to svg::Polyline::operator<<()." << std::endl;
+        }
+        points.push_back(point);
+        invalidate();
+        return *this;
+    }
+    void reserve(size_t n) { points.reserve(n); }
+    // Appends `n` points given as separate x/y arrays.
+    Polyline & append(const double *xs, const double *ys, size_t n)
+    {
+        const size_t first = points.size();
+        points.append(xs, ys, n);
+        internal::checkPoints(points, "svg::Polyline::append()", first);
+        invalidate();
+        return *this;
+    }
+    // Appends the points [first, last).
+    template <typename InputIt>
+    Polyline & append(InputIt first, InputIt last)
+    {
+        const size_t offset = points.size();
+        points.append(first, last);
+        internal::checkPoints(points, "svg::Polyline::append()", offset);
+        invalidate();
+        return *this;
+    }
+    void writeTo(Sink & sink, Layout const & l) const override
+    {
+        elemStart(sink, as_path ? "path" : "polyline");
+        writeId(sink);
+        attribute(sink, "fill", "none");
+
+        if (as_path) {
+            attrStart(sink, "d");
+            PathDataWriter(sink, l).subpath(points, 0, points.size(), false);
+        } else {
+            attrStart(sink, "points");
+            points.writeTo(sink, l);
+        }
+        attrEnd(sink);
+
+        Shape::writeAttributes(sink, l);
+        writeMarkerAttributes(sink);
+        emptyElemEnd(sink);
+    }
+    /**
+     * \brief Writes this polyline as an (equivalent) open <path> element instead
+     *
+     * Its path data uses relative and horizontal/vertical commands where shorter (see PathDataWriter),
+     * which usually makes long polylines considerably smaller, especially with fixed precision.
+     */
+    void writeAsPath(bool enable = true)
+    {
+        as_path = enable;
+        invalidate();
+    }
+    void offset(Point const & offset) override
+    {
+        invalidate();
+        if (!valid_num(offset.x) || !valid_num(offset.y)) {
+            std::cerr << "Infs or NaNs provided to svg::Polyline::offset()." << std::endl;
+        }
+        points.offset(offset);
+    }
+    std::unique_ptr<Shape> clone() const override
+    {
+        return svg::make_unique<Polyline>(*this);
+    }
+    std::unique_ptr<Shape> moveClone() override
+    {
+        return svg::make_unique<Polyline>(std::move(*this));
+    }
+    const PointBuffer & getPoints() const { return points; }
+    // Public for compatibility, call invalidate() after modifying it directly (see writeCached()).
+    PointBuffer points;
+protected:
+    void markersChanged() override { invalidate(); }
+    internal::MarkerRevisions markerRevisions() const override { return getMarkerRevisions(); }
+private:
+    bool as_path = false;
+};
+
+// None will not create any extra SVG/XML and equals "Start" (the default).
+enum class TextAnchor { Start, Middle, End, None };
+
+// None equals "auto", see https://developer.mozilla.org/en-US/docs/Web/SVG/Attribute/dominant-baseline
+enum class DominantBaseline { TextBottom, Alphabetic, Ideographic, Middle, Central, Mathematical, Hanging, TextTop, None };
+
+class Text : public SurfaceShape {
+public:
+    /**
+     * \brief Construct a new Text object which is x/y centered on default
+     */
+    Text(Point const & origin_pos, std::string const & text_content, Fill const & fill_style = Fill(),
+         Font const & font_style = Font(), Stroke const & stroke_style = Stroke(),
+         TextAnchor align = TextAnchor::Middle, DominantBaseline baseline = DominantBaseline::Middle)
+        : SurfaceShape(Kind::Text, HasFont, fill_style, stroke_style), origin(origin_pos), content(text_content), font(font_style),
+          anchor(align), dominant_baseline(baseline)
+    {
+        if (!valid_num(origin.x) || !valid_num(origin.y)) {
+            std::cerr << "Infs or NaNs provided to svg::Text()." << std::endl;
+        }
+        if (content.empty()) {
+            std::cerr << "Empty string provided to svg::Text()." << std::endl;
+        }
+    }
+    void writeTo(Sink & sink, Layout const & l) const override
+    {
+        elemStart(sink, "text");
+        writeId(sink);
+        switch (anchor) {
+        case TextAnchor::Start:
+            attribute(sink, "text-anchor", "start"); break;
+        case TextAnchor::Middle:
+            attribute(sink, "text-anchor", "middle"); break;
+        case TextAnchor::End:
+            attribute(sink, "text-anchor", "end"); break;
+        case TextAnchor::None:
+            break;
+        }
+        switch (dominant_baseline) {
+        case DominantBaseline::TextBottom:
+            attribute(sink, "dominant-baseline", "text-bottom"); break;
+        case DominantBaseline::Alphabetic:
+            attribute(sink, "dominant-baseline", "alphabetic"); break;
+        case DominantBaseline::Ideographic:
+            attribute(sink, "dominant-baseline", "ideographic"); break;
+        case DominantBaseline::Middle:
+            attribute(sink, "dominant-baseline", "middle"); break;
+        case DominantBaseline::Central:
+            attribute(sink, "dominant-baseline", "central"); break;
+        case DominantBaseline::Mathematical:
+            attribute(sink, "dominant-baseline", "mathematical"); break;
+        case DominantBaseline::Hanging:
+            attribute(sink, "dominant-baseline", "hanging"); break;
+        case DominantBaseline::TextTop:
+            attribute(sink, "dominant-baseline", "text-top"); break;
+        case DominantBaseline::None:
+            break;
+        }
+        attribute(sink, "x", coordX(origin.x, l));
+        attribute(sink, "y", coordY(origin.y, l));
+        SurfaceShape::writeAttributes(sink, l);
+        if (!sink.styleClass()) {
+            font.writeTo(sink, l);
+        }
+        sink << '>' << content;
+        elemEnd(sink, "text");
+    }
+    void offset(Point const & offset) override
+    {
+        invalidate();
+        if (!valid_num(offset.x) || !valid_num(offset.y)) {
+            std::cerr << "Infs or NaNs provided to svg::Text::offset()." << std::endl;
+        }
+        origin.x += offset.x;
+        origin.y += offset.y;
+    }
+    std::unique_ptr<Shape> clone() const override
+    {
+        return svg::make_unique<Text>(*this);
+    }
+    std::unique_ptr<Shape> moveClone() override
+    {
+        return svg::make_unique<Text>(std::move(*this));
+    }
+    void writeStyleProperties(Sink & sink, Layout const & l) const override
+    {
+        SurfaceShape::writeStyleProperties(sink, l);
+        font.writeTo(sink, l);
+    }
+private:
+    Point origin;
+    std::string content;
+    Font font;
+    TextAnchor anchor;
+    DominantBaseline dominant_baseline;
+};
+
+// TODO: allow "text with background" via filters, see https://stackoverflow.com/a/31013492
+
+// Sample charting class.
+class LineChart : public Shape {
+public:
+    LineChart(Dimensions chart_margin = Dimensions(),
+              Stroke const & axis_stroke_style = Stroke(0.5, Color::Purple))
+        : Shape(Kind::LineChart, Composite), axis_stroke(axis_stroke_style), margin(chart_margin) { }
+    LineChart & operator<<(Polyline const & polyline)
+    {
+        if (polyline.getPoints().empty()) {
+            return *this;
+        }
+
+        polylines.push_back(polyline);
+        invalidate();
+        return *this;
+    }
+    void writeTo(Sink & sink, Layout const & l) const override
+    {
+        if (polylines.empty()) {
+            return;
+        }
+
+        for (unsigned i = 0; i < polylines.size(); ++i) {
+            writePolyline(sink, polylines[i], l);
+        }
+        writeAxis(sink, l);
+    }
+    void offset(Point const & offset) override
+    {
+        invalidate();
+        if (!valid_num(offset.x) || !valid_num(offset.y)) {
+            std::cerr << "Infs or NaNs provided to svg::LineChart::offset()." << std::endl;
+        }
+        for (unsigned i = 0; i < polylines.size(); ++i) {
+            polylines[i].offset(offset);
+        }
+    }
+    std::unique_ptr<Shape> clone() const override
+    {
+        return svg::make_unique<LineChart>(*this);
+    }
+    std::unique_ptr<Shape> moveClone() override
+    {
+        return svg::make_unique<LineChart>(std::move(*this));
+    }
+private:
+    Stroke axis_stroke;
+    Dimensions margin;
+    std::vector<Polyline> polylines;
+
+    optional<Dimensions> getDimensions() const
+    {
+        if (polylines.empty()) {
+            return optional<Dimensions>();
+        }
+
+        optional<Point> min = polylines[0].getPoints().minPoint();
+        optional<Point> max = polylines[0].getPoints().maxPoint();
+        for (unsigned i = 0; i < polylines.size(); ++i) {
+            const optional<Point> poly_min = polylines[i].getPoints().minPoint();
+            const optional<Point> poly_max = polylines[i].getPoints().maxPoint();
+            if (poly_min->x < min->x)
+                min->x = poly_min->x;
+            if (poly_min->y < min->y)
+                min->y = poly_min->y;
+            if (poly_max->x > max->x)
+                max->x = poly_max->x;
+            if (poly_max->y > max->y)
+                max->y = poly_max->y;
+        }
+
+        return optional<Dimensions>(Dimensions(max->x - min->x, max->y - min->y));
+    }
+    void writeAxis(Sink & sink, Layout const & layout) const
+    {
+        optional<Dimensions> dimensions = getDimensions();
+        if (!dimensions) {
+          return;
+        }
+
+        // Make the axis 10% wider and higher than the data points.
+        double width = dimensions->width * 1.1;
+        double height = dimensions->height * 1.1;
+
+        // Draw the axis.
+        Polyline axis(axis_stroke);
+        axis << Point(margin.width, margin.height + height) << Point(margin.width, margin.height)
+             << Point(margin.width + width, margin.height);
+
+        axis.writeTo(sink, layout);
+    }
+    void writePolyline(Sink & sink, Polyline const & polyline, Layout const & layout) const
+    {
+        Polyline shifted_polyline = polyline;
+        shifted_polyline.offset(Point(margin.width, margin.height));
+        shifted_polyline.writeTo(sink, layout);
+
+        const double vertex_diameter = getDimensions()->height / 30.0;
+        PointBuffer const & vertices = shifted_polyline.getPoints();
+        for (size_t i = 0; i < vertices.size(); ++i) {
+            Circle(vertices[i], vertex_diameter, Color::Black).writeTo(sink, layout);
+        }
+    }
+};
+
+namespace animation {
+
+class Animation : public Serializeable, public Identifiable {
+public:
+    Animation(const std::string &href_id, const std::string &ani_begin, const std::string &fill_style, const std::string &duration)
+        : href(href_id), begin(ani_begin), fill(fill_style), dur(duration) { }
+    // Like Shape::toString(), animations not overriding writeTo() only get their common attributes.
+    std::string toString(Layout const & l) const override
+    {
+        std::string result;
+        if (writesItself(result, l)) {
+            return result;
+        }
+        StringSink sink;
+        writeAttributes(sink, l);
+        return sink.release();
+    }
+    virtual std::unique_ptr<Animation> clone() const = 0;
+    // Like clone() but moves (instead of copies) all data into the new object.
+    virtual std::unique_ptr<Animation> moveClone() { return clone(); }
+protected:
+    std::string href;
+    std::string begin;
+    std::string fill;
+    std::string dur;
+
+    // Writes the attributes common to all animations.
+    void writeAttributes(Sink & sink, Layout const &) const
+    {
+        if (href.empty()) {
+            std::cerr << "warning: no <href> given for animation with id=\"" << getId() << "\"." << std::endl;
+        }
+        writeId(sink);
+        attrStart(sink, "href");
+        sink << '#' << href;
+        attrEnd(sink);
+        if (!begin.empty()) {
+            attribute(sink, "begin", begin);
+        }
+        if (!fill.empty()) {
+            attribute(sink, "fill", fill);
+        }
+        if (!dur.empty()) {
+            attribute(sink, "dur", dur);
+        }
+    }
+};
+
+class SetAttributeValue : public Animation {
+public:
+    SetAttributeValue(const std::string &ani_to, const std::string &attribute_name, const std::string &href_id,
+                      const std::string &ani_begin = {}, const std::string &fill_style = {},
+                      const std::string &duration = {}, const std::string attribute_type = "CSS")
+        : Animation(href_id, ani_begin, fill_style, duration), to(ani_to), attr_name(attribute_name), attr_type(attribute_type) { }
+    void writeTo(Sink & sink, Layout const & l) const override
+    {
+        if (attr_name.empty()) {
+            std::cerr << "warning: no <attributeName> given for animation with id=\"" << getId() << "\"." << std::endl;
+        }
+        elemStart(sink, "set");
+        Animation::writeAttributes(sink, l);
+        attribute(sink, "to", to);
+        attribute(sink, "attributeName", attr_name);
+        attribute(sink, "attributeType", attr_type);
+        emptyElemEnd(sink);
+    }
+    std::unique_ptr<Animation> clone() const override
+    {
+        return svg::make_unique<SetAttributeValue>(*this);
+    }
+    std::unique_ptr<Animation> moveClone() override
+    {
+        return svg::make_unique<SetAttributeValue>(std::move(*this));
+    }
+private:
+    std::string to;
+    std::string attr_name;
+    std::string attr_type;
+};
+
+class AnimateMotion : public Animation {
+public:
+    AnimateMotion(std::vector<Point> pts, const std::string &href_id,
+                  const std::string &ani_begin = {}, const std::string &fill_style = {},
+                  const std::string &duration = {}) : Animation(href_id, ani_begin, fill_style, duration), points(pts) { }
+    void writeTo(Sink & sink, Layout const & l) const override
+    {
+        if (points.empty()) {
+            std::cerr << "warning: no <path> points given as animation path for id=\"" << getId() << "\"." << std::endl;
+        }
+        elemStart(sink, "animateMotion");
+        Animation::writeAttributes(sink, l);
+        attrStart(sink, "path");
+        if (sink.isCompact()) {
+            // Motion paths are not transformed, but use the document's precision:
+            const Layout untransformed(Dimensions(), Layout::TopLeft, 1, Point(0, 0), l.precision);
+            PathDataWriter path_data(sink, untransformed);
+            for (size_t i = 0; i < points.size(); ++i) {
+                if (i == 0) {
+                    path_data.moveTo(points[i]);
+                } else {
+                    path_data.lineTo(points[i]);
+                }
+            }
+            attrEnd(sink);
+            emptyElemEnd(sink);
+            return;
+        }
+        for (size_t i = 0; i < points.size(); ++i) {
+            if (i == 0) {
+                sink << 'M' << points[i].x << ',' << points[i].y;
+            } else {
+                sink << 'L' << points[i].x << ',' << points[i].y;
+            }
+            if (i < points.size() - 1) {
+                sink << ' ';
+            }
+        }
+        attrEnd(sink);
+        emptyElemEnd(sink);
+    }
+    std::unique_ptr<Animation> clone() const override
+    {
+        return svg::make_unique<AnimateMotion>(*this);
+    }
+    std::unique_ptr<Animation> moveClone() override
     {
-        return svg::make_unique<Elipse>(*this);
+        return svg::make_unique<AnimateMotion>(std::move(*this));
     }
 private:
-    Point center;
-    double radius_width;
-    double radius_height;
+    std::vector<Point> points;
 };
 
-class Rectangle : public SurfaceShape {
+} // end of namespace: animation (within namespace "svg")
+
+// Monotonic allocator handing out memory from large blocks which are only released all at once.
+class Arena {
 public:
-    /**
-     * Creates a rectangle (fillable shape).
-     * \param [in] edge Upper left corner of the rectangle
-     * \param [in] width Width of the rectangle
-     * \param [in] height Height of the rectangle
-     * \param [in] fill Fill style used to fill the rectangular area
-     * \param [in] stroke Stroke used to create the boundary contour
-     */
-    Rectangle(Point const & upper_left_corner, double w, double h, Fill const & fill_style = Fill(),
-              Stroke const & stroke_style = Stroke(), double rx_corner = 0.0, double ry_corner = 0.0)
-        : SurfaceShape(fill_style, stroke_style), edge(upper_left_corner), width(w), height(h), rx(rx_corner),
-          ry(ry_corner)
+    explicit Arena(size_t block_bytes = 1 << 20) : block_size(block_bytes), current(nullptr), remaining(0) { }
+    Arena(const Arena &) = delete;
+    Arena& operator=(const Arena &) = delete;
+    void *allocate(size_t size, size_t alignment)
     {
-        if (!valid_num(edge.x) || !valid_num(edge.y) || !valid_num(width) || !valid_num(height) ||
-            !valid_num(rx) || !valid_num(ry)) {
-            std::cerr << "Infs or NaNs provided to svg::Rectangle()." << std::endl;
+        size_t padding = (alignment - reinterpret_cast<uintptr_t>(current) % alignment) % alignment;
+        if (padding + size > remaining) {
+            // Oversized requests get a dedicated block, the current one is continued afterwards:
+            const size_t bytes = std::max(block_size, size + alignment);
+            blocks.emplace_back(new char[bytes]);
+            if (bytes > block_size) {
+                char *block = blocks.back().get();
+                return block + (alignment - reinterpret_cast<uintptr_t>(block) % alignment) % alignment;
+            }
+            current = blocks.back().get();
+            remaining = bytes;
+            padding = (alignment - reinterpret_cast<uintptr_t>(current) % alignment) % alignment;
         }
+        void *result = current + padding;
+        current += padding + size;
+        remaining -= padding + size;
+        return result;
     }
-    std::string toString(Layout const & l) const override
+    // Releases all memory at once, objects allocated from the arena must have been destroyed before.
+    void release()
     {
-        std::stringstream ss;
-        ss << elemStart("rect") << serializeId()
-           << attribute("x", translateX(edge.x, l))
-           << attribute("y", translateY(edge.y, l));
-        if (rx > 0.0 || ry > 0.0) {
-            ss << attribute("rx", rx) << attribute("ry", ry);
-        }
-        ss << attribute("width", translateScale(width, l))
-           << attribute("height", translateScale(height, l))
-           << SurfaceShape::toString(l) << emptyElemEnd();
-        return ss.str();
+        blocks.clear();
+        current = nullptr;
+        remaining = 0;
     }
-    void offset(Point const & offset) override
-    {
-        if (!valid_num(offset.x) || !valid_num(offset.y)) {
-            std::cerr << "Infs or NaNs provided to svg::Rectangle::offset()." << std::endl;
+private:
+    size_t block_size;
+    std::vector<std::unique_ptr<char[]>> blocks;
+    char *current;
+    size_t remaining;
+};
+
+namespace internal {
+    // Deleter for shapes owned by a Document, which may live in its Arena (destroy only) or on the
+    // heap (delete).
+    struct NodeDeleter {
+        NodeDeleter(bool arena_allocated = false) : in_arena(arena_allocated) { }
+        void operator()(Shape *shape) const
+        {
+            if (in_arena) {
+                shape->~Shape();
+            } else {
+                delete shape;
+            }
         }
-        edge.x += offset.x;
-        edge.y += offset.y;
-    }
-    Rectangle centerAt(Point const & pos) const
+        bool in_arena;
+    };
+    typedef std::unique_ptr<Shape, NodeDeleter> ShapePtr;
+
+    // Shapes of the library's types stored by value, one container per type. Deques keep the shapes
+    // (mostly) contiguous while references to them remain valid when more are added.
+    struct ShapeBuckets {
+        std::deque<Circle> circles;
+        std::deque<Elipse> elipses;
+        std::deque<Rectangle> rectangles;
+        std::deque<Line> lines;
+        std::deque<Polygon> polygons;
+        std::deque<Path> paths;
+        std::deque<Polyline> polylines;
+        std::deque<Text> texts;
+
+        std::deque<Circle> & of(Circle *) { return circles; }
+        std::deque<Elipse> & of(Elipse *) { return elipses; }
+        std::deque<Rectangle> & of(Rectangle *) { return rectangles; }
+        std::deque<Line> & of(Line *) { return lines; }
+        std::deque<Polygon> & of(Polygon *) { return polygons; }
+        std::deque<Path> & of(Path *) { return paths; }
+        std::deque<Polyline> & of(Polyline *) { return polylines; }
+        std::deque<Text> & of(Text *) { return texts; }
+        void clear()
+        {
+            circles.clear();
+            elipses.clear();
+            rectangles.clear();
+            lines.clear();
+            polygons.clear();
+            paths.clear();
+            polylines.clear();
+            texts.clear();
+        }
+    };
+    // Whether shapes of type `T` can be stored in ShapeBuckets.
+    template <typename T> struct IsBucketed : std::false_type { };
+    template <> struct IsBucketed<Circle> : std::true_type { };
+    template <> struct IsBucketed<Elipse> : std::true_type { };
+    template <> struct IsBucketed<Rectangle> : std::true_type { };
+    template <> struct IsBucketed<Line> : std::true_type { };
+    template <> struct IsBucketed<Polygon> : std::true_type { };
+    template <> struct IsBucketed<Path> : std::true_type { };
+    template <> struct IsBucketed<Polyline> : std::true_type { };
+    template <> struct IsBucketed<Text> : std::true_type { };
+
+    // Position of a shape in the document's drawing order: the bucket of its kind and its index
+    // therein, or Kind::Custom and its index in the heap/arena allocated nodes.
+    struct NodeRecord {
+        int z;
+        Shape::Kind bucket;
+        size_t index;
+    };
+}
+
+namespace internal {
+    // Whether the type of `shape` is exactly one of the library's single element shapes, rather than
+    // a custom shape or a subclass (which may write nested shapes, derive from Markerable, etc.).
+    inline bool isLibraryShape(Shape const & shape)
     {
-        if (!valid_num(pos.x) || !valid_num(pos.y)) {
-            std::cerr << "Infs or NaNs provided to svg::Rectangle::centerAt()." << std::endl;
+        switch (shape.kind()) {
+        case Shape::Kind::Circle:    return typeid(shape) == typeid(Circle);
+        case Shape::Kind::Elipse:    return typeid(shape) == typeid(Elipse);
+        case Shape::Kind::Rectangle: return typeid(shape) == typeid(Rectangle);
+        case Shape::Kind::Line:      return typeid(shape) == typeid(Line);
+        case Shape::Kind::Polygon:   return typeid(shape) == typeid(Polygon);
+        case Shape::Kind::Path:      return typeid(shape) == typeid(Path);
+        case Shape::Kind::Polyline:  return typeid(shape) == typeid(Polyline);
+        case Shape::Kind::Text:      return typeid(shape) == typeid(Text);
+        default:                     return false;
         }
-        return Rectangle(Point(pos.x - width / 2.0, pos.y - height / 2.0), width, height, fill, stroke);
     }
-    std::unique_ptr<Shape> clone() const override
+
+    // Returns the Markerable base of `shape` (or nullptr), dynamic_cast is only needed for custom
+    // shapes and subclasses of the library's shapes.
+    inline Markerable * markerable(Shape & shape)
     {
-        return svg::make_unique<Rectangle>(*this);
+        switch (shape.kind()) {
+        case Shape::Kind::Line:     return static_cast<Line*>(&shape);
+        case Shape::Kind::Polyline: return static_cast<Polyline*>(&shape);
+        default:                    return isLibraryShape(shape) ? nullptr : dynamic_cast<Markerable*>(&shape);
+        }
     }
-private:
-    Point edge;
-    double width;
-    double height;
-    double rx; //<! Rounded corner radius in x direction
-    double ry; //<! Rounded corner radius in y direction
-};
+    inline const Markerable * markerable(Shape const & shape) { return markerable(const_cast<Shape&>(shape)); }
 
-class Line : public Shape, public Markerable {
-public:
-    Line(Point const & start_pt, Point const & end_pt, Stroke const & stroke_style = Stroke())
-        : Shape(stroke_style), start_point(start_pt), end_point(end_pt)
+    // Writes the XML prolog up to (and including) "<svg ".
+    inline void writeProlog(Sink & sink)
     {
-        if (!valid_num(start_point.x) || !valid_num(start_point.y) ||
-            !valid_num(end_point.x) || !valid_num(end_point.y)) {
-            std::cerr << "Infs or NaNs provided to svg::Line()." << std::endl;
-        }
+        sink << (sink.isCompact() ? "<?xml" : "<?xml ");
+        attribute(sink, "version", "1.0");
+        attribute(sink, "standalone", "no");
+        sink << "?>";
+        whitespace(sink, "\n");
+        sink << "<!-- Generator: " << libraryName() << " (https://github.com/CodeFinder2/svg-writer), Version: " << libraryVersion() << " -->";
+        whitespace(sink, "\n");
+        sink << "<!DOCTYPE svg PUBLIC \"-//W3C//DTD SVG " << svgVersion() << "//EN\" "
+             << "\"http://www.w3.org/Graphics/SVG/1.1/DTD/svg11.dtd\">";
+        sink << (sink.isCompact() ? "<svg" : "\n<svg ");
     }
-    std::string toString(Layout const & l) const override
+    // Writes the remaining attributes of the <svg> element and closes its start tag.
+    inline void writeSvgAttributes(Sink & sink, Layout const & layout)
     {
-        std::stringstream ss;
-        ss << elemStart("line") << serializeId()
-           << attribute("x1", translateX(start_point.x, l))
-           << attribute("y1", translateY(start_point.y, l))
-           << attribute("x2", translateX(end_point.x, l))
-           << attribute("y2", translateY(end_point.y, l))
-           << Shape::toString(l) << Markerable::toString(l) << emptyElemEnd();
-        return ss.str();
+        attribute(sink, "width", layout.dimensions.width, "px");
+        attribute(sink, "height", layout.dimensions.height, "px");
+        attribute(sink, "xmlns", "http://www.w3.org/2000/svg");
+        attribute(sink, "version", svgVersion());
+        sink << '>';
+        whitespace(sink, "\n");
     }
-    void offset(Point const & offset) override
+    inline void writeMarkerDefs(Sink & sink, MarkerSet const & markers, Layout const & layout)
     {
-        if (!valid_num(offset.x) || !valid_num(offset.y)) {
-            std::cerr << "Infs or NaNs provided to svg::Line::offset()." << std::endl;
+        if (!markers.empty()) {
+            elemStart(sink, "defs", true);
+            for (const auto &m: markers) {
+                m->writeTo(sink, layout);
+            }
+            whitespace(sink, "\t");
+            elemEnd(sink, "defs");
         }
-        start_point.x += offset.x;
-        start_point.y += offset.y;
+    }
+}
 
-        end_point.x += offset.x;
-        end_point.y += offset.y;
+class Document : public Identifiable {
+public:
+    Document(Layout doc_layout = Layout())
+        : layout(doc_layout), buckets_enabled(false), arena_enabled(false),
+          order_sorted(true), caching(false), num_threads(1), compression_level(0), compact(false),
+          interning(false), markers(new internal::MarkerRegistry())
+    {
+        layout.update();
     }
-    std::unique_ptr<Shape> clone() const override
+    // A moved-from document is empty, like a default constructed one, and remains usable.
+    Document(Document && that) : Document() { swap(that); }
+    Document & operator=(Document && that)
     {
-        return svg::make_unique<Line>(*this);
+        Document moved(std::move(that));
+        swap(moved);
+        return *this; // the previous shapes are destroyed along with `moved`
     }
-private:
-    Point start_point;
-    Point end_point;
-};
+    // Destroys the shapes before the arena they may live in.
+    ~Document() { body_nodes.clear(); }
 
-class Polygon : public SurfaceShape {
-public:
-    Polygon(Fill const & fill_style = Fill(), Stroke const & stroke_style = Stroke())
-        : SurfaceShape(fill_style, stroke_style) { }
-    Polygon(const std::vector<Point> &pts, Fill const & fill_style = Fill(), Stroke const & stroke_style = Stroke())
-        : SurfaceShape(fill_style, stroke_style), points(pts)
+    Document & operator<<(Shape const & shape)
     {
-        for (size_t i = 0; i < pts.size(); ++i) {
-            if (!valid_num(pts[i].x) || !valid_num(pts[i].y)) {
-                std::cerr << "Infs or NaNs provided to svg::Polygon()." << std::endl;
-                break;
-            }
-        }
+        return add(shape.clone());
     }
-    Polygon(Stroke const & stroke_style = Stroke()) : SurfaceShape(Color::Transparent, stroke_style) { }
-    Polygon & operator<<(Point const & point)
+    Document & operator<<(Shape && shape)
     {
-        if (!valid_num(point.x) || !valid_num(point.y)) {
-            std::cerr << "Infs or NaNs provided to svg::Polygon::operator<<()." << std::endl;
-        }
-        points.push_back(point);
-        return *this;
+        return add(shape.moveClone());
     }
-    std::string toString(Layout const & l) const override
+    Document & operator<<(animation::Animation const & animation)
     {
-        std::stringstream ss;
-        ss << elemStart("polygon") << serializeId();
-
-        ss << "points=\"";
-        for (decltype(points)::size_type i = 0; i < points.size(); ++i) {
-            ss << translateX(points[i].x, l) << "," << translateY(points[i].y, l) << " ";
-        }
-        ss << "\" ";
-
-        ss << SurfaceShape::toString(l) << emptyElemEnd();
-        return ss.str();
+        return add(animation.clone());
     }
-    void offset(Point const & offset) override
+    Document & operator<<(animation::Animation && animation)
     {
-        if (!valid_num(offset.x) || !valid_num(offset.y)) {
-            std::cerr << "Infs or NaNs provided to svg::Polygon::offset()." << std::endl;
-        }
-        for (decltype(points)::size_type i = 0; i < points.size(); ++i) {
-            points[i].x += offset.x;
-            points[i].y += offset.y;
-        }
+        return add(animation.moveClone());
     }
-    std::unique_ptr<Shape> clone() const override
+    // Takes ownership of `shape` (without copying it).
+    Document & add(std::unique_ptr<Shape> shape)
     {
-        return svg::make_unique<Polygon>(*this);
+        return add(internal::ShapePtr(shape.release()));
     }
-private:
-    std::vector<Point> points;
-};
-
-class Path : public SurfaceShape {
-public:
-    Path(Fill const & fill_style = Fill(), Stroke const & stroke_style = Stroke())
-        : SurfaceShape(fill_style, stroke_style)
-    { startNewSubPath(); }
-    Path(std::vector<Point> const & pts, Fill const & fill_style = Fill(), Stroke const & stroke_style = Stroke())
-        : SurfaceShape(fill_style, stroke_style)
+    // Takes ownership of `animation` (without copying it).
+    Document & add(std::unique_ptr<animation::Animation> animation)
     {
-        for (size_t i = 0; i < pts.size(); ++i) {
-            if (!valid_num(pts[i].x) || !valid_num(pts[i].y)) {
-                std::cerr << "Infs or NaNs provided to svg::Path()." << std::endl;
-                break;
-            }
+        if (animation) {
+            animation_nodes.push_back(std::move(animation));
         }
-        startNewSubPath();
-        paths.back() = pts;
+        return *this;
     }
-    Path(Stroke const & stroke_style = Stroke()) : SurfaceShape(Color::Transparent, stroke_style)
-    {  startNewSubPath(); }
-    Path & operator<<(Point const & point)
+    /**
+     * \brief Constructs a shape (or animation) of type `T` in place, avoiding any copies
+     * \return Reference to the new element which remains valid until the document is cleared or destroyed
+     * \note Shapes are stored in the per-type buckets or allocated from the document's arena if
+     *       enabled, see useTypeBuckets() and useArena().
+     */
+    template <typename T, typename... Args>
+    T & emplace(Args&&... args)
     {
-        if (!valid_num(point.x) || !valid_num(point.y)) {
-            std::cerr << "Infs or NaNs provided to svg::Path::operator<<()." << std::endl;
-        }
-        paths.back().push_back(point);
-        return *this;
+        return emplaceNode<T>(std::is_base_of<Shape, T>(), std::forward<Args>(args)...);
     }
-    void startNewSubPath()
+    /**
+     * \brief Enables (or disables) allocating the shapes created by emplace() from a monotonic arena
+     *
+     * The memory of all shapes is then obtained in blocks of `block_size` bytes and released at once
+     * when the document is cleared or destroyed. Memory owned by the shapes themselves (points,
+     * strings, ...) is not affected. Disabling it only affects shapes emplaced afterwards.
+     */
+    void useArena(bool enable = true, size_t block_size = 1 << 20)
     {
-        if (paths.empty() || 0 < paths.back().size()) {
-            paths.emplace_back();
+        if (enable && !arena) {
+            arena.reset(new Arena(block_size));
         }
+        arena_enabled = enable;
     }
-    std::string toString(Layout const & l) const override
+    /**
+     * \brief Enables (or disables) storing the shapes created by emplace() by value, in one container
+     *        per type (Circle, Elipse, Rectangle, Line, Polygon, Path, Polyline and Text)
+     *
+     * The drawing order is kept separately, so the shapes are serialized in runs of the same type
+     * without virtual calls while walking (mostly) contiguous memory. This takes precedence over
+     * useArena() for these types. Disabling it only affects shapes emplaced afterwards.
+     */
+    void useTypeBuckets(bool enable = true)
     {
-        std::stringstream ss;
-        ss << elemStart("path") << serializeId();
-
-        ss << "d=\"";
-        for (auto const& subpath: paths) {
-            if (subpath.empty()) {
-                continue;
-            }
-
-            ss << "M";
-            for (auto const& point: subpath) {
-                ss << translateX(point.x, l) << "," << translateY(point.y, l) << " ";
-            }
-            ss << "z ";
-      }
-      ss << "\" ";
-      ss << "fill-rule=\"evenodd\" ";
-
-      ss << SurfaceShape::toString(l) << emptyElemEnd();
-      return ss.str();
+        if (enable && !buckets) {
+            buckets.reset(new internal::ShapeBuckets());
+        }
+        buckets_enabled = enable;
     }
-    void offset(Point const & offset) override
+    // Removes all shapes and animations.
+    void clear()
     {
-        if (!valid_num(offset.x) || !valid_num(offset.y)) {
-            std::cerr << "Infs or NaNs provided to svg::Path::offset()." << std::endl;
+        order.clear();
+        if (buckets) {
+            buckets->clear();
         }
-        for (auto& subpath : paths) {
-           for (auto& point : subpath) {
-                point.x += offset.x;
-                point.y += offset.y;
-            }
+        body_nodes.clear();
+        animation_nodes.clear();
+        markers->clear();
+        order_sorted = true;
+        if (arena) {
+            arena->release();
         }
     }
-    std::unique_ptr<Shape> clone() const override
+    std::string toString()
     {
-        return svg::make_unique<Path>(*this);
+        StringSink sink;
+        writeTo(sink);
+        return sink.release();
     }
-private:
-    std::vector<std::vector<Point>> paths;
-};
-
-class Polyline : public Shape, public Markerable {
-public:
-    Polyline(Stroke const & stroke_style = Stroke()) : Shape(stroke_style) { }
-    Polyline(std::vector<Point> const & pts, Stroke const & stroke_style = Stroke())
-        : Shape(stroke_style), points(pts)
+    bool isAnimated() const { return !animation_nodes.empty(); }
+    /**
+     * \brief Stores the SVG into a file on disk
+     * \param [in] filename File name (may already contain desired extension)
+     * \param [in] auto_append \c true to append the appropriate extension if not already present,
+     *             \c false to not change `file_name`
+     * \return \c true on success, \c false on failure
+     * \see getFileName()
+     */
+    bool save(const std::string &filename, bool auto_append = true)
     {
-        for (size_t i = 0; i < pts.size(); ++i) {
-            if (!valid_num(pts[i].x) || !valid_num(pts[i].y)) {
-                std::cerr << "Infs or NaNs provided to svg::Polyline()." << std::endl;
-                break;
-            }
+        setFileName(filename, auto_append);
+        if (!canWriteFile()) {
+            return false;
+        }
+        internal::OwnedFileSink sink(file_name);
+        if (!sink.isOpen()) {
+            return false;
         }
+
+        const bool written = writeFile(sink);
+        return sink.close() && written;
     }
-    Polyline & operator<<(Point const & point)
+    /**
+     * \brief Like save() but writes the file on a background thread
+     *
+     * The document is serialized on the calling thread in chunks of `chunk_size` bytes, each of which
+     * is handed to the writer thread as soon as it is complete. Thus, the document may be modified
+     * (or destroyed) right after this function returns while the file is still being written.
+     * \return Future becoming \c true once all bytes have been written successfully
+     * \note Wait for the future before the program exits, otherwise the file may be incomplete.
+     */
+    std::future<bool> saveAsync(const std::string &filename, bool auto_append = true, size_t chunk_size = 1 << 20)
     {
-        if (!valid_num(point.x) || !valid_num(point.y)) {
-            std::cerr << "Infs or NaNs provided to svg::Polyline::operator<<()." << std::endl;
+        setFileName(filename, auto_append);
+        if (!canWriteFile()) {
+            std::promise<bool> rejected;
+            rejected.set_value(false);
+            return rejected.get_future();
         }
-        points.push_back(point);
-        return *this;
+        std::shared_ptr<internal::AsyncFileWriter> writer = internal::AsyncFileWriter::start(file_name);
+        std::future<bool> result = writer->result();
+        {
+            internal::AsyncFileSink sink(writer, chunk_size);
+            try {
+                if (!writeFile(sink)) {
+                    writer->fail();
+                }
+            } catch (...) {
+                writer->fail();
+                throw;
+            }
+        }
+        return result;
     }
-    std::string toString(Layout const & l) const override
+    /**
+     * \brief Enables gzip compression of saved files (.svgz)
+     *
+     * save() and saveAsync() then compress the file whatever its name is, with auto_append they
+     * also use the extension ".svgz" (animated documents are never compressed). Regardless of this
+     * setting, files whose name ends with ".svgz" are always compressed.
+     * \param [in] level 1 (fastest) to 9 (smallest), -1 for zlib's default, 0 to disable compression
+     * \note Requires zlib, see SVG_WRITER_HAVE_ZLIB, saving compressed files fails (without creating
+     * them) otherwise.
+     */
+    void setCompression(int level = -1)
     {
-        std::stringstream ss;
-        ss << elemStart("polyline") << serializeId() << attribute("fill", "none");
-
-        ss << "points=\"";
-        for (unsigned i = 0; i < points.size(); ++i) {
-            ss << translateX(points[i].x, l) << "," << translateY(points[i].y, l) << " ";
+        if (level < -1 || level > 9) {
+            throw std::invalid_argument("svg::Document::setCompression() requires a level in [-1, 9].");
         }
-        ss << "\" ";
-
-        ss << Shape::toString(l) << Markerable::toString(l) << emptyElemEnd();
-        return ss.str();
+        compression_level = level;
     }
-    void offset(Point const & offset) override
+    /**
+     * \brief Returns the actual file name
+     * \return file name incl. extension used in `save()`
+     * \see save()
+     */
+    const std::string &getFileName() const { return file_name; }
+    Layout getLayout() const { return layout; }
+    // Sets the precision of all coordinates and lengths, see svg::Precision.
+    void setPrecision(Precision const & p) { layout.setPrecision(p); }
+    /**
+     * \brief Enables (or disables) caching the serialized bytes of every shape, see Shape::writeCached()
+     *
+     * Repeatedly writing a document then only serializes the shapes modified since the last write
+     * (or all of them if the layout has changed). Shapes must only be modified via their member
+     * functions, e.g., through the references returned by emplace().
+     */
+    void setCaching(bool enable = true) { caching = enable; }
+    // Enables (or disables) compact output without formatting whitespace and default attributes.
+    void setCompact(bool enable = true) { compact = enable; }
+    /**
+     * \brief Enables (or disables) sharing identical style attributes of shapes via CSS classes
+     *
+     * Every distinct combination of style attributes (stroke, fill, font) is then written once as
+     * a rule of a <style> element and the shapes only refer to it by class="sN". Custom shapes
+     * (incl. subclasses of the library's shapes) keep their own style attributes.
+     */
+    void setStyleInterning(bool enable = true) { interning = enable; }
+    /**
+     * \brief Sets the number of threads used to serialize the shapes (default: 1)
+     *
+     * The shapes are then split into consecutive chunks which are serialized concurrently into
+     * separate buffers and written in order, so the output is identical to the sequential one. Small
+     * documents are still serialized sequentially. Pass 0 to use all hardware threads.
+     * \note The whole output is buffered in memory before it is written to the sink.
+     */
+    void setThreads(unsigned threads)
     {
-        if (!valid_num(offset.x) || !valid_num(offset.y)) {
-            std::cerr << "Infs or NaNs provided to svg::Polyline::offset()." << std::endl;
-        }
-        for (unsigned i = 0; i < points.size(); ++i) {
-            points[i].x += offset.x;
-            points[i].y += offset.y;
-        }
+        num_threads = threads != 0 ? threads : std::max(1u, std::thread::hardware_concurrency());
     }
-    std::unique_ptr<Shape> clone() const override
+    void writeToStream(std::ostream& str)
     {
-        return svg::make_unique<Polyline>(*this);
+        OStreamSink sink(str);
+        writeTo(sink);
     }
-    std::vector<Point> points;
-};
-
-// None will not create any extra SVG/XML and equals "Start" (the default).
-enum class TextAnchor { Start, Middle, End, None };
-
-// None equals "auto", see https://developer.mozilla.org/en-US/docs/Web/SVG/Attribute/dominant-baseline
-enum class DominantBaseline { TextBottom, Alphabetic, Ideographic, Middle, Central, Mathematical, Hanging, TextTop, None };
-
-class Text : public SurfaceShape {
-public:
     /**
-     * \brief Construct a new Text object which is x/y centered on default
+     * \brief Serializes the whole document into `sink`
+     * \note The sink is not flushed, any bytes still buffered in it are written upon its next
+     *       flush() or destruction.
      */
-    Text(Point const & origin_pos, std::string const & text_content, Fill const & fill_style = Fill(),
-         Font const & font_style = Font(), Stroke const & stroke_style = Stroke(),
-         TextAnchor align = TextAnchor::Middle, DominantBaseline baseline = DominantBaseline::Middle)
-        : SurfaceShape(fill_style, stroke_style), origin(origin_pos), content(text_content), font(font_style),
-          anchor(align), dominant_baseline(baseline)
+    void writeTo(Sink & sink)
     {
-        if (!valid_num(origin.x) || !valid_num(origin.y)) {
-            std::cerr << "Infs or NaNs provided to svg::Text()." << std::endl;
+        layout.update(); // precompute the adaptive precision once per serialization
+        internal::SinkModeScope mode(sink, compact);
+        internal::StyleCache styles(layout, compact, false);
+        sink.setStyleCache(&styles);
+        internal::writeProlog(sink);
+        writeId(sink);
+        internal::writeSvgAttributes(sink, layout);
+        // Note: animation nodes do not have to be sorted (order doesn't matter).
+        sortByZ();
+        internal::writeMarkerDefs(sink, markers->used(), layout);
+        if (interning) {
+            writeStyles(sink);
         }
-        if (content.empty()) {
-            std::cerr << "Empty string provided to svg::Text()." << std::endl;
+        writeBody(sink);
+        node_styles.clear();
+        style_classes.clear();
+        for (const auto& animation_node : animation_nodes) {
+            animation_node->writeTo(sink, layout);
         }
+        elemEnd(sink, "svg");
     }
-    std::string toString(Layout const & l) const override
+protected:
+    std::string file_name;
+    Layout layout;
+
+    std::unique_ptr<internal::ShapeBuckets> buckets;
+    bool buckets_enabled;
+    // Shapes not stored in `buckets`, in the order of insertion:
+    std::vector<internal::ShapePtr> body_nodes;
+    std::unique_ptr<Arena> arena;
+    bool arena_enabled;
+    // Drawing order of all shapes:
+    std::vector<internal::NodeRecord> order;
+    bool order_sorted;  // whether `order` is sorted by the z's stored in it
+    bool caching;
+    unsigned num_threads;
+    int compression_level;
+    bool compact;
+    bool interning;
+    // Markers used by the shapes, stable address as the shapes refer to it:
+    std::unique_ptr<internal::MarkerRegistry> markers;
+    std::vector<std::unique_ptr<animation::Animation>> animation_nodes;
+    // While writing with style interning: CSS class names and the class index of every body node.
+    std::vector<std::string> style_classes;
+    std::vector<size_t> node_styles;
+
+    static const size_t NO_STYLE = size_t(-1);
+
+    void swap(Document & that)
     {
-        std::stringstream ss;
-        ss << elemStart("text") << serializeId();
-        switch (anchor) {
-        case TextAnchor::Start:
-            ss << attribute("text-anchor", "start"); break;
-        case TextAnchor::Middle:
-            ss << attribute("text-anchor", "middle"); break;
-        case TextAnchor::End:
-            ss << attribute("text-anchor", "end"); break;
-        case TextAnchor::None:
-            break;
+        using std::swap;
+        swap(id, that.id);
+        swap(file_name, that.file_name);
+        swap(layout, that.layout);
+        swap(buckets, that.buckets);
+        swap(buckets_enabled, that.buckets_enabled);
+        swap(body_nodes, that.body_nodes);
+        swap(arena, that.arena);
+        swap(arena_enabled, that.arena_enabled);
+        swap(order, that.order);
+        swap(order_sorted, that.order_sorted);
+        swap(caching, that.caching);
+        swap(num_threads, that.num_threads);
+        swap(compression_level, that.compression_level);
+        swap(compact, that.compact);
+        swap(interning, that.interning);
+        swap(markers, that.markers);
+        swap(animation_nodes, that.animation_nodes);
+        swap(style_classes, that.style_classes);
+        swap(node_styles, that.node_styles);
+    }
+
+    // Collects the distinct style properties of all shapes and writes them as CSS classes.
+    void writeStyles(Sink & sink)
+    {
+        std::unordered_map<std::string, size_t> rules;
+        std::vector<const std::string*> ordered_rules;
+        node_styles.assign(order.size(), size_t(NO_STYLE));
+        std::string declarations;
+        StringSink css(declarations);
+        css.setCss();
+        css.setCompact(sink.isCompact());
+        internal::StyleCache styles(layout, css.isCompact(), true);
+        css.setStyleCache(&styles);
+        for (size_t i = 0; i < order.size(); ++i) {
+            Shape const & shape = node(order[i]);
+            if (!internal::isLibraryShape(shape) || !shape.hasStyleProperties()) {
+                continue;
+            }
+            declarations.clear();
+            shape.writeStyleProperties(css, layout);
+            css.flush();
+            if (declarations.empty()) {
+                continue;
+            }
+            auto found = rules.find(declarations);
+            if (found == rules.end()) {
+                found = rules.emplace(declarations, rules.size()).first;
+                ordered_rules.push_back(&found->first);
+            }
+            node_styles[i] = found->second;
         }
-        switch (dominant_baseline) {
-        case DominantBaseline::TextBottom:
-            ss << attribute("dominant-baseline", "text-bottom"); break;
-        case DominantBaseline::Alphabetic:
-            ss << attribute("dominant-baseline", "alphabetic"); break;
-        case DominantBaseline::Ideographic:
-            ss << attribute("dominant-baseline", "ideographic"); break;
-        case DominantBaseline::Middle:
-            ss << attribute("dominant-baseline", "middle"); break;
-        case DominantBaseline::Central:
-            ss << attribute("dominant-baseline", "central"); break;
-        case DominantBaseline::Mathematical:
-            ss << attribute("dominant-baseline", "mathematical"); break;
-        case DominantBaseline::Hanging:
-            ss << attribute("dominant-baseline", "hanging"); break;
-        case DominantBaseline::TextTop:
-            ss << attribute("dominant-baseline", "text-top"); break;
-        case DominantBaseline::None:
-            break;
+        style_classes.resize(ordered_rules.size());
+        for (size_t c = 0; c < style_classes.size(); ++c) {
+            style_classes[c] = "s" + std::to_string(c);
         }
-        ss << attribute("x", translateX(origin.x, l))
-           << attribute("y", translateY(origin.y, l))
-           << SurfaceShape::toString(l) << font.toString(l)
-           << ">" << content << elemEnd("text");
-        return ss.str();
+        if (ordered_rules.empty()) {
+            return;
+        }
+        elemStart(sink, "style", true);
+        for (size_t c = 0; c < ordered_rules.size(); ++c) {
+            const std::string & rule = *ordered_rules[c];
+            whitespace(sink, "\t\t");
+            // The last declaration does not need its semicolon:
+            sink << '.' << style_classes[c] << '{';
+            sink.write(rule.data(), sink.isCompact() ? rule.size() - 1 : rule.size());
+            sink << '}';
+            whitespace(sink, "\n");
+        }
+        whitespace(sink, "\t");
+        elemEnd(sink, "style");
     }
-    void offset(Point const & offset) override
+
+    void setFileName(const std::string &filename, bool auto_append)
     {
-        if (!valid_num(offset.x) || !valid_num(offset.y)) {
-            std::cerr << "Infs or NaNs provided to svg::Text::offset()." << std::endl;
+        file_name = filename;
+        // Append ".html" if not already given AND the document contains animations:
+        if (auto_append) {
+            if (isAnimated()) {
+                if (!ends_with(file_name, ".html")) {
+                    file_name += ".html";
+                }
+            } else if (compression_level != 0) {
+                if (ends_with(file_name, ".svg")) {
+                    file_name += 'z';
+                } else if (!ends_with(file_name, ".svgz")) {
+                    file_name += ".svgz";
+                }
+            } else if (!ends_with(file_name, ".svg") && !ends_with(file_name, ".svgz")) {
+                file_name += ".svg";
+            }
         }
-        origin.x += offset.x;
-        origin.y += offset.y;
     }
-    std::unique_ptr<Shape> clone() const override
+    // Whether the file is gzip-compressed, independent of auto_append.
+    bool compressesFile() const
     {
-        return svg::make_unique<Text>(*this);
+        return ends_with(file_name, ".svgz") || (compression_level != 0 && !isAnimated());
     }
-private:
-    Point origin;
-    std::string content;
-    Font font;
-    TextAnchor anchor;
-    DominantBaseline dominant_baseline;
-};
-
-// TODO: allow "text with background" via filters, see https://stackoverflow.com/a/31013492
-
-// Sample charting class.
-// FIXME: this design is bad since "Polyline::points" needs to be public (in contrast to all other classes)...
-class LineChart : public Shape {
-public:
-    LineChart(Dimensions chart_margin = Dimensions(),
-              Stroke const & axis_stroke_style = Stroke(0.5, Color::Purple))
-        : axis_stroke(axis_stroke_style), margin(chart_margin) { }
-    LineChart & operator<<(Polyline const & polyline)
+    // Checks (before the file is created) that the file can be written in the requested format.
+    bool canWriteFile() const
     {
-        if (polyline.points.empty()) {
-            return *this;
+#ifndef SVG_WRITER_HAVE_ZLIB
+        if (compressesFile()) {
+            std::cerr << "Saving " << file_name << " requires zlib (SVG_WRITER_HAVE_ZLIB)." << std::endl;
+            return false;
         }
-
-        polylines.push_back(polyline);
-        return *this;
+#endif
+        return true;
     }
-    std::string toString(Layout const & l) const override
+    // Writes the document to `file`, compressed if requested, see compressesFile().
+    bool writeFile(Sink & file)
     {
-        if (polylines.empty()) {
-            return "";
+        if (!compressesFile()) {
+            writeTo(file);
+            return true;
         }
+#ifdef SVG_WRITER_HAVE_ZLIB
+        GzipSink compressed(file, compression_level != 0 ? compression_level : Z_DEFAULT_COMPRESSION);
+        writeTo(compressed);
+        return compressed.finish();
+#else
+        return canWriteFile();
+#endif
+    }
 
-        std::string ret;
-        for (unsigned i = 0; i < polylines.size(); ++i) {
-            ret += polylineToString(polylines[i], l);
-        }
+    // Minimum number of shapes per thread for parallel serialization to pay off.
+    static const size_t MIN_SHAPES_PER_THREAD = 4096;
 
-        return ret + axisString(l);
-    }
-    void offset(Point const & offset) override
+    /**
+     * Sorts the drawing order by ascending z, keeping shapes with equal z in their current order
+     * (that is, the order of insertion unless their z's have been changed). The z's are read from
+     * the shapes on every call, as they may be changed any time after insertion. Nothing is moved if
+     * neither shapes with a lower z than the last one have been added nor any z has been changed
+     * since the previous call. Otherwise, a counting sort over the (typically few) z layers takes
+     * O(n) instead of O(n log n).
+     */
+    void sortByZ()
     {
-        if (!valid_num(offset.x) || !valid_num(offset.y)) {
-            std::cerr << "Infs or NaNs provided to svg::LineChart::offset()." << std::endl;
+        // The z of a shape may have been changed since its insertion:
+        int min_z = 0;
+        int max_z = 0;
+        for (auto &record : order) {
+            const int z = node(record).z;
+            if (z != record.z) {
+                record.z = z;
+                order_sorted = false;
+            }
+            min_z = std::min(min_z, z);
+            max_z = std::max(max_z, z);
         }
-        for (unsigned i = 0; i < polylines.size(); ++i) {
-            polylines[i].offset(offset);
+        if (order_sorted) {
+            return;
         }
+        const size_t layers = size_t(std::int64_t(max_z) - min_z) + 1;
+        if (layers > std::max(order.size(), size_t(1) << 16)) { // sparse z's, counting would not pay off
+            std::stable_sort(order.begin(), order.end(),
+                             [](const internal::NodeRecord &a, const internal::NodeRecord &b){
+                return a.z < b.z;
+            });
+        } else {
+            // Number of shapes per z, turned into the index of the first one of each z:
+            std::vector<size_t> first_of_z(layers, 0);
+            for (auto const & record : order) {
+                first_of_z[size_t(record.z - min_z)]++;
+            }
+            size_t first = 0;
+            for (auto &slot : first_of_z) {
+                const size_t count = slot;
+                slot = first;
+                first += count;
+            }
+            std::vector<internal::NodeRecord> sorted(order.size());
+            for (auto const & record : order) {
+                sorted[first_of_z[size_t(record.z - min_z)]++] = record;
+            }
+            order.swap(sorted);
+        }
+        order_sorted = true;
     }
-    std::unique_ptr<Shape> clone() const override
+    Shape & node(internal::NodeRecord const & record) const
     {
-        return svg::make_unique<LineChart>(*this);
+        switch (record.bucket) {
+        case Shape::Kind::Circle:    return buckets->circles[record.index];
+        case Shape::Kind::Elipse:    return buckets->elipses[record.index];
+        case Shape::Kind::Rectangle: return buckets->rectangles[record.index];
+        case Shape::Kind::Line:      return buckets->lines[record.index];
+        case Shape::Kind::Polygon:   return buckets->polygons[record.index];
+        case Shape::Kind::Path:      return buckets->paths[record.index];
+        case Shape::Kind::Polyline:  return buckets->polylines[record.index];
+        case Shape::Kind::Text:      return buckets->texts[record.index];
+        default:                     return *body_nodes[record.index];
+        }
     }
-private:
-    Stroke axis_stroke;
-    Dimensions margin;
-    std::vector<Polyline> polylines;
-
-    optional<Dimensions> getDimensions() const
+    // Writes the shapes order[first, last), which are all stored in `nodes`.
+    template <typename Nodes>
+    void writeRun(Sink & sink, Nodes const & nodes, size_t first, size_t last) const
     {
-        if (polylines.empty()) {
-            return optional<Dimensions>();
+        for (size_t i = first; i < last; ++i) {
+            if (!node_styles.empty()) {
+                sink.setStyleClass(node_styles[i] != NO_STYLE ? style_classes[node_styles[i]].c_str() : nullptr);
+            }
+            writeNode(sink, nodes[order[i].index]);
         }
-
-        optional<Point> min = getMinPoint(polylines[0].points);
-        optional<Point> max = getMaxPoint(polylines[0].points);
-        for (unsigned i = 0; i < polylines.size(); ++i) {
-            if (getMinPoint(polylines[i].points)->x < min->x)
-                min->x = getMinPoint(polylines[i].points)->x;
-            if (getMinPoint(polylines[i].points)->y < min->y)
-                min->y = getMinPoint(polylines[i].points)->y;
-            if (getMaxPoint(polylines[i].points)->x > max->x)
-                max->x = getMaxPoint(polylines[i].points)->x;
-            if (getMaxPoint(polylines[i].points)->y > max->y)
-                max->y = getMaxPoint(polylines[i].points)->y;
+    }
+    // Shapes of a known type are written without virtual calls:
+    template <typename T>
+    void writeNode(Sink & sink, T const & shape) const
+    {
+        if (caching) {
+            shape.writeCached(sink, layout);
+        } else {
+            shape.T::writeTo(sink, layout);
         }
-
-        return optional<Dimensions>(Dimensions(max->x - min->x, max->y - min->y));
     }
-    std::string axisString(Layout const & layout) const
+    void writeNode(Sink & sink, internal::ShapePtr const & shape) const
     {
-        optional<Dimensions> dimensions = getDimensions();
-        if (!dimensions) {
-          return {};
+        if (caching) {
+            shape->writeCached(sink, layout);
+        } else {
+            shape->writeTo(sink, layout);
         }
-
-        // Make the axis 10% wider and higher than the data points.
-        double width = dimensions->width * 1.1;
-        double height = dimensions->height * 1.1;
-
-        // Draw the axis.
-        Polyline axis(axis_stroke);
-        axis << Point(margin.width, margin.height + height) << Point(margin.width, margin.height)
-             << Point(margin.width + width, margin.height);
-
-        return axis.toString(layout);
     }
-    std::string polylineToString(Polyline const & polyline, Layout const & layout) const
+    void writeShapes(Sink & sink, size_t first, size_t last) const
     {
-        Polyline shifted_polyline = polyline;
-        shifted_polyline.offset(Point(margin.width, margin.height));
-
-        std::vector<Circle> vertices;
-        for (unsigned i = 0; i < shifted_polyline.points.size(); ++i) {
-            vertices.push_back(Circle(shifted_polyline.points[i], getDimensions()->height / 30.0, Color::Black));
+        for (size_t i = first; i < last; ) {
+            // Consecutive shapes from the same bucket:
+            const Shape::Kind bucket = order[i].bucket;
+            size_t end = i + 1;
+            while (end < last && order[end].bucket == bucket) {
+                ++end;
+            }
+            switch (bucket) {
+            case Shape::Kind::Circle:    writeRun(sink, buckets->circles, i, end); break;
+            case Shape::Kind::Elipse:    writeRun(sink, buckets->elipses, i, end); break;
+            case Shape::Kind::Rectangle: writeRun(sink, buckets->rectangles, i, end); break;
+            case Shape::Kind::Line:      writeRun(sink, buckets->lines, i, end); break;
+            case Shape::Kind::Polygon:   writeRun(sink, buckets->polygons, i, end); break;
+            case Shape::Kind::Path:      writeRun(sink, buckets->paths, i, end); break;
+            case Shape::Kind::Polyline:  writeRun(sink, buckets->polylines, i, end); break;
+            case Shape::Kind::Text:      writeRun(sink, buckets->texts, i, end); break;
+            default:                     writeRun(sink, body_nodes, i, end); break;
+            }
+            i = end;
         }
-
-        return shifted_polyline.toString(layout) + vectorToString(vertices, layout);
+        sink.setStyleClass(nullptr);
     }
-};
-
-namespace animation {
-
-class Animation : public Serializeable, public Identifiable {
-public:
-    Animation(const std::string &href_id, const std::string &ani_begin, const std::string &fill_style, const std::string &duration)
-        : href(href_id), begin(ani_begin), fill(fill_style), dur(duration) { }
-    std::string toString(Layout const &) const override
+    void writeBody(Sink & sink) const
     {
-        if (href.empty()) {
-            std::cerr << "warning: no <href> given for animation with id=\"" << getId() << "\"." << std::endl;
+        const size_t n = order.size();
+        const size_t threads = std::min(size_t(num_threads), n / MIN_SHAPES_PER_THREAD);
+        if (threads <= 1) {
+            writeShapes(sink, 0, n);
+            return;
         }
-        std::stringstream ss;
-        ss << serializeId() << attribute("href", "#" + href);
-        if (!begin.empty()) {
-            ss << attribute("begin", begin);
+        // Several chunks per thread balance shapes of different sizes:
+        const size_t num_chunks = 4 * threads;
+        std::vector<std::string> chunks(num_chunks);
+        std::vector<std::exception_ptr> errors(num_chunks);
+        std::atomic<size_t> next_chunk(0);
+        auto worker = [&]() {
+            internal::StyleCache styles(layout, sink.isCompact(), false); // one per thread
+            for (size_t c = next_chunk++; c < num_chunks; c = next_chunk++) {
+                try {
+                    StringSink chunk;
+                    chunk.setCompact(sink.isCompact());
+                    chunk.setStyleCache(&styles);
+                    writeShapes(chunk, n * c / num_chunks, n * (c + 1) / num_chunks);
+                    chunks[c] = chunk.release();
+                } catch (...) {
+                    errors[c] = std::current_exception();
+                }
+            }
+        };
+        std::vector<std::thread> pool;
+        for (size_t t = 1; t < threads; ++t) {
+            pool.emplace_back(worker);
         }
-        if (!fill.empty()) {
-            ss << attribute("fill", fill);
+        worker();
+        for (auto &thread : pool) {
+            thread.join();
         }
-        if (!dur.empty()) {
-            ss << attribute("dur", dur);
+        for (size_t c = 0; c < num_chunks; ++c) {
+            if (errors[c]) {
+                std::rethrow_exception(errors[c]);
+            }
+            sink << chunks[c];
+            std::string().swap(chunks[c]);
         }
-        return ss.str();
     }
-    virtual std::unique_ptr<Animation> clone() const = 0;
-protected:
-    std::string href;
-    std::string begin;
-    std::string fill;
-    std::string dur;
-};
 
-class SetAttributeValue : public Animation {
-public:
-    SetAttributeValue(const std::string &ani_to, const std::string &attribute_name, const std::string &href_id,
-                      const std::string &ani_begin = {}, const std::string &fill_style = {},
-                      const std::string &duration = {}, const std::string attribute_type = "CSS")
-        : Animation(href_id, ani_begin, fill_style, duration), to(ani_to), attr_name(attribute_name), attr_type(attribute_type) { }
-    std::string toString(Layout const & l) const override
+    Document & add(internal::ShapePtr shape)
     {
-        if (attr_name.empty()) {
-            std::cerr << "warning: no <attributeName> given for animation with id=\"" << getId() << "\"." << std::endl;
+        if (shape) {
+            insert(*shape, Shape::Kind::Custom, body_nodes.size());
+            body_nodes.push_back(std::move(shape));
         }
-        std::stringstream ss;
-        ss << elemStart("set") << Animation::toString(l) << attribute("to", to)
-           << attribute("attributeName", attr_name)  << attribute("attributeType", attr_type)
-           << emptyElemEnd();
-        return ss.str();
+        return *this;
     }
-    std::unique_ptr<Animation> clone() const override
+    // Appends `shape`, stored at `index` of the bucket of kind `bucket`, to the drawing order.
+    void insert(Shape & shape, Shape::Kind bucket, size_t index)
     {
-        return svg::make_unique<SetAttributeValue>(*this);
+        Markerable *m = internal::markerable(shape);
+        if (m) {
+            m->attach(markers.get());
+        }
+        order_sorted = order_sorted && (order.empty() || order.back().z <= shape.z);
+        order.push_back(internal::NodeRecord{ shape.z, bucket, index });
     }
-private:
-    std::string to;
-    std::string attr_name;
-    std::string attr_type;
-};
-
-class AnimateMotion : public Animation {
-public:
-    AnimateMotion(std::vector<Point> pts, const std::string &href_id,
-                  const std::string &ani_begin = {}, const std::string &fill_style = {},
-                  const std::string &duration = {}) : Animation(href_id, ani_begin, fill_style, duration), points(pts) { }
-    std::string toString(Layout const & l) const override
+    template <typename T, typename... Args>
+    T & emplaceNode(std::true_type /* is shape */, Args&&... args)
     {
-        if (points.empty()) {
-            std::cerr << "warning: no <path> points given as animation path for id=\"" << getId() << "\"." << std::endl;
+        return emplaceShape<T>(internal::IsBucketed<T>(), std::forward<Args>(args)...);
+    }
+    template <typename T, typename... Args>
+    T & emplaceShape(std::true_type /* bucketed */, Args&&... args)
+    {
+        if (!buckets_enabled) {
+            return emplaceShape<T>(std::false_type(), std::forward<Args>(args)...);
         }
-        std::stringstream ss;
-        ss << elemStart("animateMotion") << Animation::toString(l) << "path=";
-        for (size_t i = 0; i < points.size(); ++i) {
-            if (i == 0) {
-                ss << "\"M" << points[i].x << "," << points[i].y;
-            } else {
-                ss << "L" << points[i].x << "," << points[i].y;
-            }
-            if (i < points.size() - 1) {
-                ss << " ";
-            }
+        std::deque<T> & bucket = buckets->of(static_cast<T*>(nullptr));
+        bucket.emplace_back(std::forward<Args>(args)...);
+        insert(bucket.back(), bucket.back().kind(), bucket.size() - 1);
+        return bucket.back();
+    }
+    template <typename T, typename... Args>
+    T & emplaceShape(std::false_type, Args&&... args)
+    {
+        if (!arena_enabled) {
+            return emplaceNode<T>(std::false_type(), std::forward<Args>(args)...);
         }
-        ss << "\" " << emptyElemEnd();
-        return ss.str();
+        T *node = new (arena->allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+        add(internal::ShapePtr(node, internal::NodeDeleter(true)));
+        return *node;
     }
-    std::unique_ptr<Animation> clone() const override
+    template <typename T, typename... Args>
+    T & emplaceNode(std::false_type, Args&&... args)
     {
-        return svg::make_unique<AnimateMotion>(*this);
+        std::unique_ptr<T> node = svg::make_unique<T>(std::forward<Args>(args)...);
+        T & result = *node;
+        add(std::move(node));
+        return result;
     }
-private:
-    std::vector<Point> points;
 };
 
-} // end of namespace: animation (within namespace "svg")
-
-class Document : public Identifiable {
+/**
+ * \brief Document that writes every element to its sink as soon as it is inserted
+ *
+ * In contrast to Document, shapes are not kept in memory: the XML prolog and the <svg> start tag are
+ * written by open() (or the first insertion), each shape is serialized immediately and finalize()
+ * writes the closing tag. Memory use is therefore bounded by the largest single element plus the
+ * spill limit described below. This imposes the following constraints:
+ *  - Shapes must be inserted in non-decreasing z-order. Shapes with a higher z than the last written
+ *    one are buffered (serialized) in per-z spill buckets of at most `spill_limit` bytes in total;
+ *    once the limit is exceeded, the lowest bucket is written. Inserting a shape with a lower z
+ *    than an already written one throws std::invalid_argument.
+ *  - Markers must be declared before the document is opened, see declare(), as the <defs> section
+ *    is written along with the header. Shapes referring to undeclared markers are rejected.
+ *  - The layout, precision and ID cannot be changed after opening.
+ */
+class StreamingDocument : public Identifiable {
 public:
-    Document(Layout doc_layout = Layout()) : layout(doc_layout), needs_sorting(false) { }
-
-    Document & operator<<(Shape const & shape)
+    // Writes to `sink` which must outlive this document (or the call to finalize()).
+    StreamingDocument(Sink & target, Layout doc_layout = Layout(), size_t spill_limit = 0)
+        : layout(doc_layout), sink(&target), max_spilled(spill_limit), spilled(0), compact(false), opened(false),
+          finalized(false), committed(false), committed_z(0)
     {
-        body_nodes.push_back(shape.clone());
-        needs_sorting = needs_sorting || body_nodes.back()->z != 0;
-        return *this;
+        layout.update();
     }
-    Document & operator<<(animation::Animation const & animation)
+    // Writes to the file `filename` (which is used as is), check isOpen() for success.
+    StreamingDocument(const std::string & filename, Layout doc_layout = Layout(), size_t spill_limit = 0)
+        : layout(doc_layout), file(new FileSinkType(filename)), sink(file.get()), max_spilled(spill_limit),
+          spilled(0), compact(false), opened(false), finalized(false), committed(false), committed_z(0)
     {
-        animation_nodes.push_back(animation.clone());
-        return *this;
+        layout.update();
     }
-    std::string toString()
+    ~StreamingDocument()
     {
-        std::stringstream ss;
-        writeToStream(ss);
-        return ss.str();
+        finalize();
+    }
+    StreamingDocument(const StreamingDocument &) = delete;
+    StreamingDocument & operator=(const StreamingDocument &) = delete;
+
+    // \c false if the file given upon construction could not be opened.
+    bool isOpen() const { return !file || file->isOpen(); }
+    Layout getLayout() const { return layout; }
+    // Sets the precision of all coordinates and lengths, see svg::Precision.
+    void setPrecision(Precision const & p)
+    {
+        throwIfOpened("setPrecision");
+        layout.setPrecision(p);
+    }
+    // Enables (or disables) compact output, see Document::setCompact().
+    void setCompact(bool enable = true)
+    {
+        throwIfOpened("setCompact");
+        compact = enable;
     }
-    bool isAnimated() const { return !animation_nodes.empty(); }
     /**
-     * \brief Stores the SVG into a file on disk
-     * \param [in] filename File name (may already contain desired extension)
-     * \param [in] auto_append \c true to append the appropriate extension if not already present,
-     *             \c false to not change `file_name`
-     * \return \c true on success, \c false on failure
-     * \see getFileName()
+     * \brief Declares a marker that shapes may refer to
+     * \note `marker` must outlive the call to open(), declaring after opening throws.
      */
-    bool save(const std::string &filename, bool auto_append = true)
+    StreamingDocument & declare(Marker const & marker)
     {
-        file_name = filename;
-        // Append ".html" if not already given AND the document contains animations:
-        if (auto_append) {
-            if (isAnimated()) {
-                if (!ends_with(file_name, ".html")) {
-                    file_name += ".html";
-                }
-            } else if (!ends_with(file_name, ".svg")) {
-                file_name += ".svg";
-            }
+        throwIfOpened("declare");
+        if (marker.valid()) {
+            markers.insert(&marker);
         }
-        std::ofstream ofs(file_name.c_str());
-        if (!ofs.is_open()) {
-            return false;
+        return *this;
+    }
+    // Writes the header including the declared markers (done implicitly by the first insertion).
+    void open()
+    {
+        if (opened) {
+            return;
         }
-
-        writeToStream(ofs);
-        return ofs.good();
+        opened = true;
+        internal::SinkModeScope mode(*sink, compact);
+        internal::writeProlog(*sink);
+        writeId(*sink);
+        internal::writeSvgAttributes(*sink, layout);
+        internal::writeMarkerDefs(*sink, markers, layout);
+    }
+    StreamingDocument & operator<<(Shape const & shape)
+    {
+        checkMarkers(shape);
+        open();
+        if (committed && shape.z < committed_z) {
+            throw std::invalid_argument("svg::StreamingDocument: shape with z-order below an already written one.");
+        }
+        internal::SinkModeScope mode(*sink, compact);
+        if ((committed && shape.z == committed_z) || (spilled_buckets.empty() && max_spilled == 0)) {
+            shape.writeTo(*sink, layout);
+            committed = true;
+            committed_z = shape.z;
+            return *this;
+        }
+        StringSink serialized;
+        serialized.setCompact(compact);
+        shape.writeTo(serialized, layout);
+        spilled += serialized.str().size();
+        spilled_buckets[shape.z] += serialized.str();
+        while (spilled > max_spilled) {
+            writeLowestBucket();
+        }
+        return *this;
+    }
+    // Animations are written immediately (their order does not matter).
+    StreamingDocument & operator<<(animation::Animation const & animation)
+    {
+        open();
+        internal::SinkModeScope mode(*sink, compact);
+        animation.writeTo(*sink, layout);
+        return *this;
     }
     /**
-     * \brief Returns the actual file name
-     * \return file name incl. extension used in `save()`
-     * \see save()
+     * \brief Writes all buffered shapes and the closing tag, then flushes (and closes) the output
+     * \return \c true if all bytes have been written successfully
+     * \note Called by the destructor, further calls have no effect.
      */
-    const std::string &getFileName() const { return file_name; }
-    Layout getLayout() const { return layout; }
-protected:
-    void writeToStream(std::ostream& str)
+    bool finalize()
     {
-        str << "<?xml " << attribute("version", "1.0") << attribute("standalone", "no") << "?>\n"
-            << "<!-- Generator: " << libraryName() << " (https://github.com/CodeFinder2/svg-writer), Version: " << libraryVersion() << " -->\n"
-            << "<!DOCTYPE svg PUBLIC \"-//W3C//DTD SVG " << svgVersion() << "//EN\" "
-            << "\"http://www.w3.org/Graphics/SVG/1.1/DTD/svg11.dtd\">\n<svg "
-            << serializeId()
-            << attribute("width", layout.dimensions.width, "px")
-            << attribute("height", layout.dimensions.height, "px")
-            << attribute("xmlns", "http://www.w3.org/2000/svg")
-            << attribute("version", svgVersion()) << ">\n";
-        if (needs_sorting) {
-            // Note: animation nodes do not have to be sorted (order doesn't matter).
-            std::stable_sort(body_nodes.begin(), body_nodes.end(),
-                             [](const std::unique_ptr<Shape> &a, const std::unique_ptr<Shape> &b){
-                // Ascending order rgd. z, keep equal z's (especially the default z=0) in the
-                // order of insertions:
-                return a->z < b->z;
-            });
-        }
-        // Catch all markers and add them here if used:
-        internal::MarkerSet all_used_markers(internal::compareMarker);
-        for (const auto& body_node : body_nodes) {
-            auto m = dynamic_cast<const Markerable*>(body_node.get());
-            if (m) {
-                auto markers = m->getUsedMarkers();
-                for (const auto &i: markers) {
-                    for (const auto &j: all_used_markers) {
-                        if (i->getId() == j->getId() && *i != *j) {
-                            std::cerr << "Marker collision detected for ID=" << i->getId()
-                                      << " within this element: \n"
-                                      << body_node->toString(layout)
-                                      << "\nExpect markers not to be rendered correctly." << std::endl;
-                        }
-                    }
-                    all_used_markers.insert(i);
-                }
+        if (!finalized) {
+            finalized = true;
+            open();
+            internal::SinkModeScope mode(*sink, compact);
+            while (!spilled_buckets.empty()) {
+                writeLowestBucket();
             }
-        }
-        if (!all_used_markers.empty()) {
-            str << elemStart("defs", true);
-            for (const auto &m: all_used_markers) {
-                str << m->toString(layout);
+            elemEnd(*sink, "svg");
+            if (file) {
+                return file->close();
             }
-            str << "\t" << elemEnd("defs");
+            sink->flush();
         }
-        for (const auto& body_node : body_nodes) {
-            str << body_node->toString(layout);
-        }
-        for (const auto& animation_node : animation_nodes) {
-            str << animation_node->toString(layout);
-        }
-        str << elemEnd("svg");
+        return sink->good();
     }
-    std::string file_name;
+private:
+    typedef internal::OwnedFileSink FileSinkType;
     Layout layout;
+    std::unique_ptr<FileSinkType> file;
+    Sink *sink;
+    internal::MarkerSet markers{internal::compareMarker};
+    // Serialized shapes not written yet, by z-order.
+    std::map<int, std::string> spilled_buckets;
+    size_t max_spilled;
+    size_t spilled;
+    bool compact;
+    bool opened;
+    bool finalized;
+    // Whether any shape has been written and the z-order of the last one.
+    bool committed;
+    int committed_z;
 
-    std::vector<std::unique_ptr<Shape>> body_nodes;
-    bool needs_sorting;
-    std::vector<std::unique_ptr<animation::Animation>> animation_nodes;
+    void throwIfOpened(const char *where) const
+    {
+        if (opened) {
+            throw std::invalid_argument(std::string("svg::StreamingDocument::") + where
+                                        + "() must be called before the document is opened.");
+        }
+    }
+    void checkMarkers(Shape const & shape) const
+    {
+        const Markerable *m = internal::markerable(shape);
+        if (m) {
+            for (const auto &marker: m->getUsedMarkers()) {
+                auto declared = markers.find(marker);
+                if (declared == markers.end() || (*declared != marker && **declared != *marker)) {
+                    throw std::invalid_argument("svg::StreamingDocument: marker with ID=" + marker->getId()
+                                                + " has not been declared.");
+                }
+            }
+        }
+    }
+    void writeLowestBucket()
+    {
+        auto lowest = spilled_buckets.begin();
+        *sink << lowest->second;
+        spilled -= lowest->second.size();
+        committed = true;
+        committed_z = lowest->first;
+        spilled_buckets.erase(lowest);
+    }
 };
 
 } // end of namespace: svg
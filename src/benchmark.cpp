@@ -0,0 +1,274 @@
+/*******************************************************************************
+*  The "New BSD License" : http://www.opensource.org/licenses/bsd-license.php  *
+********************************************************************************
+
+Copyright (c) 2010, Mark Turney,
+              2021, Adrian Böckenkamp
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the <organization> nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+******************************************************************************/
+
+#include <svg_writer/svg_writer.hpp>
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <thread>
+
+using namespace svg;
+
+// Runs `fn` `repetitions` times and prints the average wall clock time per run.
+static void measure(const char *name, int repetitions, std::function<size_t()> fn)
+{
+    size_t bytes = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < repetitions; ++i) {
+        bytes += fn();
+    }
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+    std::printf("%-40s %10.2f ms/run %12zu bytes/run\n", name, elapsed.count() / repetitions,
+                bytes / size_t(repetitions));
+}
+
+// Point-heavy documents: a few polylines with many (non-integral) vertices each.
+static void benchmarkNumberFormatting()
+{
+    const size_t NUM_POINTS = 1000000;
+    std::vector<Point> points(NUM_POINTS);
+    for (size_t i = 0; i < NUM_POINTS; ++i) {
+        points[i] = Point(i * 0.01, 50.0 + 40.0 * std::sin(i * 0.001));
+    }
+
+    measure("number formatting: std::ostringstream", 5, [&]() {
+        std::ostringstream ss;
+        ss.precision(17);
+        for (size_t i = 0; i < points.size(); ++i) {
+            ss << points[i].x << ',' << points[i].y << ' ';
+        }
+        return ss.str().size();
+    });
+    measure("number formatting: svg::Sink", 5, [&]() {
+        StringSink sink;
+        for (size_t i = 0; i < points.size(); ++i) {
+            sink << points[i].x << ',' << points[i].y << ' ';
+        }
+        return sink.str().size();
+    });
+
+    Document doc(Layout(Dimensions(10000, 100), Layout::BottomLeft));
+    doc << Polyline(points, Stroke(0.5, Color::Blue));
+    measure("Document::toString() with 10^6 points", 5, [&]() {
+        return doc.toString().size();
+    });
+    doc.setPrecision(Precision::fixed(2));
+    measure("... with Precision::fixed(2)", 5, [&]() {
+        return doc.toString().size();
+    });
+}
+
+// Building and destroying documents with many small shapes.
+static void benchmarkDocumentConstruction()
+{
+    const int NUM_SHAPES = 1000000;
+    for (int use_arena = 0; use_arena < 2; ++use_arena) {
+        measure(use_arena ? "10^6 emplace() + destruction, arena" : "10^6 emplace() + destruction, heap", 3, [&]() {
+            Document doc;
+            doc.useArena(use_arena != 0);
+            for (int i = 0; i < NUM_SHAPES; ++i) {
+                if (i % 2) {
+                    doc.emplace<Circle>(Point(i % 400, i % 300), 2, Color::Red);
+                } else {
+                    doc.emplace<Rectangle>(Point(i % 400, i % 300), 2, 3, Color::Blue);
+                }
+            }
+            return size_t(0);
+        });
+    }
+}
+
+// Serializing 10^6 small shapes depending on how the document stores them.
+static void benchmarkShapeStorage()
+{
+    const char *names[] = { "10^6 shapes toString(), heap", "10^6 shapes toString(), arena",
+                            "10^6 shapes toString(), type buckets" };
+    for (int storage = 0; storage < 3; ++storage) {
+        Document doc(Layout(Dimensions(400, 300)));
+        doc.useArena(storage == 1);
+        doc.useTypeBuckets(storage == 2);
+        for (int i = 0; i < 1000000; ++i) {
+            if (i % 2) {
+                doc.emplace<Circle>(Point(i * 0.37, i * 0.11), 2.5, Color::Red);
+            } else {
+                doc.emplace<Rectangle>(Point(i * 0.37, i * 0.11), 2, 3, Color::Blue);
+            }
+        }
+        measure(names[storage], 3, [&]() {
+            return doc.toString().size();
+        });
+    }
+}
+
+// Re-serializing a document of which only a few shapes change between the writes.
+static void benchmarkRepeatedSaves()
+{
+    const int NUM_SHAPES = 100000;
+    for (int caching = 0; caching < 2; ++caching) {
+        Document doc(Layout(Dimensions(400, 300)));
+        doc.setCaching(caching != 0);
+        std::vector<Circle*> circles;
+        for (int i = 0; i < NUM_SHAPES; ++i) {
+            circles.push_back(&doc.emplace<Circle>(Point(i * 0.37, i * 0.11), 2.5, Color::Red));
+        }
+        doc.toString(); // fill the cache
+        int frame = 0;
+        measure(caching ? "10^5 shapes, 1% modified, cached" : "10^5 shapes, 1% modified, uncached", 10, [&]() {
+            for (size_t i = size_t(frame++); i < circles.size(); i += 100) {
+                circles[i]->offset(Point(0.5, 0.5));
+            }
+            return doc.toString().size();
+        });
+    }
+}
+
+// Default vs. compact output of many small shapes.
+static void benchmarkCompactOutput()
+{
+    Document doc(Layout(Dimensions(400, 300)));
+    for (int i = 0; i < 100000; ++i) {
+        doc.emplace<Circle>(Point(i % 400, i % 300), 2, Color::Red, Stroke(1, Color::Black));
+    }
+    measure("10^5 shapes, default output", 5, [&]() {
+        return doc.toString().size();
+    });
+    doc.setCompact();
+    measure("10^5 shapes, compact output", 5, [&]() {
+        return doc.toString().size();
+    });
+}
+
+// Serializing one object of each style type 10^6 times, formatted anew each time or copied from a
+// document's internal::StyleCache.
+static void benchmarkStyleSerialization()
+{
+    const int NUM_WRITES = 1000000;
+    const Layout layout(Dimensions(400, 300), Layout::BottomLeft, 2.5);
+    auto run = [&](Serializeable const & style, bool cached) {
+        internal::StyleCache cache(layout, false, false);
+        StringSink sink;
+        sink.setStyleCache(cached ? &cache : nullptr);
+        for (int i = 0; i < NUM_WRITES; ++i) {
+            style.writeTo(sink, layout);
+        }
+        return sink.str().size();
+    };
+    const Color color(12, 34, 56);
+    const Fill fill(Color::Orange, 0.5);
+    const Stroke stroke(1.5, Color::Black, false, 4, { 5, 2, 1, 2 });
+    const Font font(10, "Verdana");
+    measure("10^6 Color::writeTo()", 3, [&]() { return run(color, false); });
+    for (int cached = 0; cached < 2; ++cached) {
+        measure(cached ? "10^6 Fill::writeTo(), StyleCache" : "10^6 Fill::writeTo()", 3, [&]() { return run(fill, cached != 0); });
+        measure(cached ? "10^6 Stroke::writeTo(), StyleCache" : "10^6 Stroke::writeTo()", 3, [&]() { return run(stroke, cached != 0); });
+        measure(cached ? "10^6 Font::writeTo(), StyleCache" : "10^6 Font::writeTo()", 3, [&]() { return run(font, cached != 0); });
+    }
+}
+
+// One-shot serialization of documents with many shapes, their styles taken from a few (or as many
+// distinct) fills, strokes and fonts.
+static void benchmarkStyledDocuments()
+{
+    const int NUM_SHAPES = 300000;
+    const Color colors[] = { Color::Red, Color::Blue, Color::Green, Color::Orange };
+    for (int distinct = 0; distinct < 2; ++distinct) {
+        measure(distinct ? "3*10^5 shapes, distinct styles, one save" : "3*10^5 shapes, 16 styles, one save", 3, [&]() {
+            Document doc(Layout(Dimensions(400, 300), Layout::BottomLeft, 2.5));
+            for (int i = 0; i < NUM_SHAPES; ++i) {
+                const Color color = distinct ? Color(i % 256, i / 256 % 256, i / 65536) : colors[i % 4];
+                const Stroke stroke(1.5, colors[i / 4 % 4], false, 4, { 5, 2 });
+                const Point position(i % 400, i / 400 % 300);
+                switch (i % 3) {
+                case 0:  doc.emplace<Circle>(position, 2, Fill(color), stroke); break;
+                case 1:  doc.emplace<Rectangle>(position, 3, 2, Fill(color), stroke); break;
+                default: doc.emplace<Text>(position, "label", Fill(color), Font(10, "Verdana"), stroke); break;
+                }
+            }
+            return doc.toString().size();
+        });
+    }
+}
+
+// Many shapes sharing a few styles, with and without CSS classes for them.
+static void benchmarkStyleInterning()
+{
+    const Color colors[] = { Color::Red, Color::Blue, Color::Green, Color::Orange };
+    Document doc(Layout(Dimensions(400, 300)));
+    for (int i = 0; i < 100000; ++i) {
+        doc.emplace<Circle>(Point(i % 400, i % 300), 2, colors[i % 4], Stroke(1, Color::Black));
+    }
+    for (int interning = 0; interning < 2; ++interning) {
+        doc.setStyleInterning(interning != 0);
+        measure(interning ? "10^5 shapes, 4 styles, interned" : "10^5 shapes, 4 styles, attributes", 5, [&]() {
+            return doc.toString().size();
+        });
+    }
+}
+
+// Serializing documents with 10^5 .. 10^7 shapes using an increasing number of threads.
+static void benchmarkParallelSerialization(bool large)
+{
+    const unsigned max_threads = std::max(1u, std::thread::hardware_concurrency());
+    for (int num_shapes = 100000; num_shapes <= (large ? 10000000 : 1000000); num_shapes *= 10) {
+        Document doc(Layout(Dimensions(400, 300)));
+        doc.useArena();
+        for (int i = 0; i < num_shapes; ++i) {
+            doc.emplace<Circle>(Point(i * 0.37, i * 0.11), 2.5, Color::Red);
+        }
+        for (unsigned threads = 1; threads <= max_threads; threads *= 2) {
+            char name[64];
+            std::snprintf(name, sizeof(name), "%d shapes, %u thread(s)", num_shapes, threads);
+            doc.setThreads(threads);
+            measure(name, 3, [&]() {
+                return doc.toString().size();
+            });
+        }
+    }
+}
+
+// Pass "--large" to include documents with 10^7 shapes (requires several GB of memory).
+int main(int argc, char **argv)
+{
+    const bool large = argc > 1 && std::strcmp(argv[1], "--large") == 0;
+    benchmarkNumberFormatting();
+    benchmarkDocumentConstruction();
+    benchmarkShapeStorage();
+    benchmarkRepeatedSaves();
+    benchmarkCompactOutput();
+    benchmarkStyleSerialization();
+    benchmarkStyledDocuments();
+    benchmarkStyleInterning();
+    benchmarkParallelSerialization(large);
+    return 0;
+}
@@ -0,0 +1,423 @@
+/*******************************************************************************
+*  The "New BSD License" : http://www.opensource.org/licenses/bsd-license.php  *
+********************************************************************************
+
+Copyright (c) 2010, Mark Turney,
+              2021, Adrian Böckenkamp
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the <organization> nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+******************************************************************************/
+
+// Regression tests, run by ctest. Every test is a function returning normally on success.
+
+#include <svg_writer/svg_writer.hpp>
+
+#include <cstdio>
+#include <cstdlib>
+
+#ifdef SVG_WRITER_POSIX_IO
+#include <sys/stat.h>
+#endif
+
+using namespace svg;
+
+static int failures = 0;
+
+#define CHECK(condition) \
+    do { \
+        if (!(condition)) { \
+            std::fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #condition); \
+            failures++; \
+        } \
+    } while (false)
+
+// Move-assigning a document must destroy its shapes before the arena they live in.
+static void testMoveAssignWithArena()
+{
+    Document doc;
+    doc.useArena();
+    for (int i = 0; i < 100; ++i) {
+        doc.emplace<Circle>(Point(i, i), 2, Color::Red);
+    }
+    doc = Document(Layout(Dimensions(10, 10)));
+    doc.useArena();
+    doc.emplace<Circle>(Point(1, 1), 2, Color::Red);
+    CHECK(doc.toString().find("<circle") != std::string::npos);
+}
+
+// Moved-from documents are empty and remain usable, including their marker registry.
+static void testMovedFromDocument()
+{
+    Marker arrow("arrow", 10, 10, 0, 5, Circle(Point(5, 5), 3, Fill(Color::Red)));
+    Document a;
+    a.useTypeBuckets();
+    a.useArena();
+    a << Circle(Point(1, 1), 2, Color::Red);
+    Document b(std::move(a));
+    Line line(Point(0, 0), Point(1, 1), Stroke(1, Color::Black));
+    line.setEndMarker(&arrow);
+    a << line << Polyline(Stroke(1, Color::Black));
+    a.emplace<Circle>(Point(2, 2), 2, Color::Blue);
+    CHECK(a.toString().find("id=\"arrow\"") != std::string::npos);
+    b = std::move(a);
+    a << line;
+    a.clear();
+    CHECK(a.toString().find("<line") == std::string::npos);
+    CHECK(b.toString().find("<line") != std::string::npos);
+}
+
+// Polyline::points stays public and every PointBuffer representation survives copies and moves.
+static void testPointBufferStorage()
+{
+    Polyline polyline;
+    polyline.points.push_back(Point(1, 2));
+    polyline.points = std::vector<Point>{ Point(3, 4), Point(5, 6) };
+    CHECK(polyline.points.size() == 2 && polyline.points[1].x == 5);
+
+    const double xs[] = { 1, 2, 3 };
+    const double ys[] = { 4, 5, 6 };
+    std::vector<PointBuffer> buffers;
+    buffers.push_back(PointBuffer(std::vector<Point>{ Point(1, 4), Point(2, 5), Point(3, 6) }));
+    buffers.push_back(PointBuffer(PointColumns({ 1, 2, 3 }, { 4, 5, 6 })));
+    buffers.push_back(PointBuffer(PointView(xs, ys, 3)));
+    for (size_t i = 0; i < buffers.size(); ++i) {
+        PointBuffer copy(buffers[i]);
+        PointBuffer moved(std::move(copy));
+        copy = moved;
+        moved = buffers[(i + 1) % buffers.size()];
+        const std::vector<Point> points = copy.toVector();
+        CHECK(points.size() == 3 && points[0].x == 1 && points[2].y == 6);
+        copy.push_back(Point(7, 8)); // detaches views
+        CHECK(copy.size() == 4 && copy[3].y == 8 && buffers[i].size() == 3);
+    }
+}
+
+// Layout's members are public, modifying them directly must affect all coordinates alike.
+static void testLayoutModifiedDirectly()
+{
+    Layout layout(Dimensions(100, 100), Layout::BottomLeft);
+    const Circle circle(Point(10, 10), 4, Color::Red);
+    layout.scale = 2;
+    std::string svg = circle.toString(layout);
+    CHECK(svg.find("cx=\"20\" cy=\"80\" r=\"4\"") != std::string::npos);
+    layout.origin = Layout::TopLeft;
+    layout.precision = Precision::adaptive(0.05);
+    const Circle offset(Point(10.26, 10.26), 4, Color::Red);
+    svg = offset.toString(layout);
+    CHECK(svg.find("cx=\"20.5\" cy=\"20.5\"") != std::string::npos);
+    const std::vector<Point> points = { Point(1, 1), Point(2.26, 3) };
+    svg = Polyline(points, Stroke(1, Color::Black)).toString(layout);
+    CHECK(svg.find("2,2 4.5,6") != std::string::npos);
+}
+
+// Viewed points are written in chunks, which must be separated like points of any other storage.
+static void testPointViewChunks()
+{
+    std::vector<double> xs;
+    std::vector<double> ys;
+    std::vector<Point> points;
+    for (int i = 0; i < 300; ++i) {
+        xs.push_back(i);
+        ys.push_back(i);
+        points.push_back(Point(i, i));
+    }
+    for (int compact = 0; compact < 2; ++compact) {
+        Document viewed(Layout(Dimensions(300, 300), Layout::TopLeft));
+        Document copied(Layout(Dimensions(300, 300), Layout::TopLeft));
+        viewed.setCompact(compact != 0);
+        copied.setCompact(compact != 0);
+        viewed << Polyline(PointView(xs.data(), ys.data(), xs.size()), Stroke(1, Color::Black));
+        copied << Polyline(points, Stroke(1, Color::Black));
+        const std::string svg = viewed.toString();
+        CHECK(svg == copied.toString());
+        CHECK(svg.find("127,127 128,128") != std::string::npos);
+        CHECK(svg.find(compact ? "299,299\"" : "299,299 \"") != std::string::npos);
+    }
+}
+
+// Changing z after insertion must reorder the shapes, even if all z's were zero before.
+static void testZChangedAfterInsertion()
+{
+    for (int buckets = 0; buckets < 2; ++buckets) {
+        Document doc;
+        doc.useTypeBuckets(buckets != 0);
+        Circle &red = doc.emplace<Circle>(Point(1, 1), 2, Color::Red);
+        doc.emplace<Circle>(Point(2, 2), 2, Color::Blue);
+        std::string svg = doc.toString();
+        CHECK(svg.find("rgb(255,0,0)") < svg.find("rgb(0,0,255)"));
+        red.z = 5;
+        svg = doc.toString();
+        CHECK(svg.find("rgb(255,0,0)") > svg.find("rgb(0,0,255)"));
+    }
+}
+
+// Writing compact documents must not change the mode of the caller's sink.
+static void testSinkModeRestored()
+{
+    StringSink sink;
+    Document doc;
+    doc.setCompact();
+    doc << Circle(Point(1, 1), 2, Color::Red);
+    doc.writeTo(sink);
+    CHECK(!sink.isCompact() && sink.styleClass() == nullptr);
+    {
+        StreamingDocument streaming(sink);
+        streaming.setCompact();
+        CHECK(!sink.isCompact());
+        streaming << Circle(Point(1, 1), 2, Color::Red);
+        CHECK(!sink.isCompact());
+        CHECK(streaming.finalize());
+    }
+    CHECK(!sink.isCompact());
+    CHECK(sink.str().find("<circle cx=\"1\"") != std::string::npos);
+}
+
+// Cached shapes must pick up a new ID of a marker they refer to.
+static void testCachedMarkerReference()
+{
+    Marker arrow("a", 10, 10, 0, 5, Circle(Point(5, 5), 3, Fill(Color::Red)));
+    Document doc;
+    doc.setCaching();
+    doc.emplace<Line>(Point(0, 0), Point(1, 1), Stroke(1, Color::Black)).setEndMarker(&arrow);
+    CHECK(doc.toString().find("url(#a)") != std::string::npos);
+    arrow.setId("b");
+    const std::string svg = doc.toString();
+    CHECK(svg.find("url(#b)") != std::string::npos && svg.find("url(#a)") == std::string::npos);
+}
+
+// A marker renamed while in use must still be released once no shape refers to it anymore.
+static void testRenamedMarkerReleased()
+{
+    for (int written = 0; written < 2; ++written) {
+        Marker replacement("m2", 10, 10, 0, 5, Circle(Point(5, 5), 3, Fill(Color::Blue)));
+        Document doc;
+        Line &line = doc.emplace<Line>(Point(0, 0), Point(1, 1), Stroke(1, Color::Black));
+        {
+            Marker original("m1", 10, 10, 0, 5, Circle(Point(5, 5), 3, Fill(Color::Red)));
+            line.setStartMarker(&original);
+            original.setId("renamed");
+            if (written) {
+                CHECK(doc.toString().find("id=\"renamed\"") != std::string::npos);
+            }
+            line.setStartMarker(&replacement);
+        }
+        const std::string svg = doc.toString();
+        CHECK(svg.find("id=\"m2\"") != std::string::npos && svg.find("renamed") == std::string::npos);
+    }
+}
+
+#ifdef SVG_WRITER_HAVE_ZLIB
+static const bool have_zlib = true;
+#else
+static const bool have_zlib = false;
+#endif
+
+// Whether `filename` exists and starts with the gzip magic bytes.
+static bool isGzipFile(const std::string &filename)
+{
+    std::FILE *file = std::fopen(filename.c_str(), "rb");
+    if (!file) {
+        return false;
+    }
+    const bool gzip = std::fgetc(file) == 0x1f && std::fgetc(file) == 0x8b;
+    std::fclose(file);
+    return gzip;
+}
+
+static bool fileExists(const std::string &filename)
+{
+    std::FILE *file = std::fopen(filename.c_str(), "rb");
+    if (file) {
+        std::fclose(file);
+    }
+    return file != nullptr;
+}
+
+// A compressed asynchronous save must report failure (without creating the file) if zlib is missing.
+static void testSaveAsyncCompressed()
+{
+    Document doc;
+    doc.emplace<Circle>(Point(5, 5), 2, Color::Red);
+    const std::string filename = "svg_writer_test_async.svgz";
+    std::remove(filename.c_str());
+    const bool saved = doc.saveAsync(filename).get();
+    CHECK(saved == have_zlib);
+    CHECK(have_zlib ? isGzipFile(filename) : !fileExists(filename));
+    std::remove(filename.c_str());
+}
+
+#ifdef SVG_WRITER_POSIX_IO
+// New files get the permissions std::ofstream would create them with, 0666 minus the umask.
+static void testSavedFilePermissions()
+{
+    const std::string filename = "svg_writer_test_mode.svg";
+    std::remove(filename.c_str());
+    const mode_t previous = umask(002);
+    Document doc;
+    CHECK(doc.save(filename));
+    umask(previous);
+    struct stat info;
+    CHECK(stat(filename.c_str(), &info) == 0 && (info.st_mode & 0777) == 0664);
+    std::remove(filename.c_str());
+}
+#endif
+
+// Compression is requested either by a ".svgz" name or by setCompression(), whatever auto_append
+// is. Without zlib, such a save must fail before creating the file.
+static void testSaveCompressed()
+{
+    Document doc;
+    doc.emplace<Circle>(Point(5, 5), 2, Color::Red);
+    const std::string by_name = "svg_writer_test_name.svgz";
+    const std::string by_level = "svg_writer_test_level.svg";
+    std::remove(by_name.c_str());
+    std::remove(by_level.c_str());
+    const bool saved_by_name = doc.save(by_name);
+    doc.setCompression(6);
+    const bool saved_by_level = doc.save(by_level, false);
+    CHECK(doc.getFileName() == by_level);
+    CHECK(saved_by_name == have_zlib);
+    CHECK(have_zlib ? isGzipFile(by_name) : !fileExists(by_name));
+    CHECK(saved_by_level == have_zlib);
+    CHECK(have_zlib ? isGzipFile(by_level) : !fileExists(by_level));
+    std::remove(by_name.c_str());
+    std::remove(by_level.c_str());
+}
+
+// A custom shape written for versions before sinks, it only overrides toString().
+class LegacyDot : public SurfaceShape {
+public:
+    LegacyDot() : SurfaceShape(Fill(Color::Red), Stroke(1, Color::Black)) { }
+    std::string toString(Layout const & l) const override
+    {
+        return elemStart("circle") + attribute("cx", translateX(1, l)) + attribute("cy", translateY(1, l))
+            + attribute("r", 2) + SurfaceShape::toString(l) + emptyElemEnd();
+    }
+    void offset(Point const &) override { }
+    std::unique_ptr<Shape> clone() const override { return std::unique_ptr<Shape>(new LegacyDot(*this)); }
+};
+
+// Shapes only overriding toString() are written as before, and get their attributes from the base.
+static void testLegacyShape()
+{
+    const Layout layout(Dimensions(10, 10), Layout::TopLeft);
+    const std::string expected = "<circle cx=\"1\" cy=\"1\" r=\"2\" stroke-width=\"1\" stroke=\"rgb(0,0,0)\" "
+                                 "stroke-dashoffset=\"0\" fill=\"rgb(255,0,0)\" />";
+    CHECK(LegacyDot().toString(layout).find(expected) != std::string::npos);
+    Document doc(layout);
+    doc << LegacyDot();
+    CHECK(doc.toString().find(expected) != std::string::npos);
+    CHECK(Circle(Point(1, 1), 4, Color::Red).toString(layout).find("<circle cx=\"1\" cy=\"1\" r=\"2\"") != std::string::npos);
+}
+
+// A subclass of a library shape that also refers to markers.
+class MarkedCircle : public Circle, public Markerable {
+public:
+    MarkedCircle() : Circle(Point(1, 1), 2, Fill(Color::Red)) { }
+    std::unique_ptr<Shape> clone() const override { return std::unique_ptr<Shape>(new MarkedCircle(*this)); }
+};
+
+// The markers of subclasses of the library's shapes must be written as well.
+static void testMarkedSubclass()
+{
+    Marker arrow("arrow", 10, 10, 0, 5, Circle(Point(5, 5), 3, Fill(Color::Red)));
+    MarkedCircle circle;
+    circle.setEndMarker(&arrow);
+    Document doc;
+    doc << circle;
+    CHECK(doc.toString().find("id=\"arrow\"") != std::string::npos);
+}
+
+// Styles are shared by value during a write, so shapes with equal styles write the same attributes
+// and a modified style is written anew.
+static void testStyleCache()
+{
+    Document doc;
+    Circle &first = doc.emplace<Circle>(Point(1, 1), 2, Fill(Color::Red), Stroke(1, Color::Black));
+    doc.emplace<Circle>(Point(3, 3), 2, Fill(Color::Red), Stroke(1, Color::Black));
+    const std::string attributes = "fill=\"rgb(255,0,0)\" ";
+    std::string svg = doc.toString();
+    CHECK(svg.find(attributes) != svg.rfind(attributes));
+    first.setStroke(Stroke(2, Color::Blue));
+    svg = doc.toString();
+    CHECK(svg.find("stroke-width=\"2\"") != std::string::npos && svg.find("stroke=\"rgb(0,0,255)\"") != std::string::npos);
+    CHECK(svg.find("stroke-width=\"1\"") != std::string::npos && svg.find("stroke=\"rgb(0,0,0)\"") != std::string::npos);
+}
+
+// A custom shape consisting of two circles with their own styles.
+class TwoCircles : public Shape {
+public:
+    TwoCircles() : Shape(Stroke(1, Color::Black)) { }
+    void writeTo(Sink & sink, Layout const & l) const override
+    {
+        Circle(Point(1, 1), 2, Fill(Color::Green)).writeTo(sink, l);
+        Circle(Point(3, 3), 2, Fill(Color::Blue)).writeTo(sink, l);
+    }
+    void offset(Point const &) override { }
+    std::unique_ptr<Shape> clone() const override { return std::unique_ptr<Shape>(new TwoCircles(*this)); }
+};
+
+// With style interning, the children of custom shapes must keep their own styles.
+static void testInterningCustomShape()
+{
+    Document plain;
+    plain << TwoCircles();
+    Document interned;
+    interned.setStyleInterning();
+    interned << Circle(Point(5, 5), 2, Fill(Color::Red)) << TwoCircles();
+    const std::string svg = interned.toString();
+    CHECK(svg.find("class=\"s0\"") != std::string::npos && svg.find("class=\"s1\"") == std::string::npos);
+    const std::string children = plain.toString();
+    const size_t first = children.find("<circle");
+    const size_t last = children.rfind("/>") + 2;
+    CHECK(first != std::string::npos && svg.find(children.substr(first, last - first)) != std::string::npos);
+}
+
+int main()
+{
+    testMoveAssignWithArena();
+    testMovedFromDocument();
+    testPointBufferStorage();
+    testLayoutModifiedDirectly();
+    testPointViewChunks();
+    testZChangedAfterInsertion();
+    testSinkModeRestored();
+    testCachedMarkerReference();
+    testRenamedMarkerReleased();
+    testLegacyShape();
+    testMarkedSubclass();
+    testStyleCache();
+    testInterningCustomShape();
+    testSaveAsyncCompressed();
+    testSaveCompressed();
+#ifdef SVG_WRITER_POSIX_IO
+    testSavedFilePermissions();
+#endif
+    if (failures != 0) {
+        std::fprintf(stderr, "%d check(s) failed\n", failures);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}